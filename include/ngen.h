@@ -0,0 +1,77 @@
+#ifndef NEURALGEN_NGEN_H_
+#define NEURALGEN_NGEN_H_
+
+/*
+  C ABI of networks generated by NeuralGen, implemented by generated code
+  compiled with `-DNGEN_LIBRARY` as a shared library.
+
+  Inputs are laid out as in input files: `ngen_input_size` bytes per
+  input (elements of the input layer, may be raw data). Outputs are
+  `ngen_output_size` floats per input. All buffers are owned by callers.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// version of the ABI, bumped when the ABI changes incompatibly
+#define NGEN_ABI_VERSION 1
+
+// handle of a loaded network
+typedef struct ngen_network ngen_network;
+
+// get version of the ABI implemented by the library
+int ngen_abi_version(void);
+
+// load network with the specific model file, returns NULL if failed
+//   model:    model file, ignored if the model is embedded
+//   platform: OpenCL platform ID, ignored by C++ networks
+//   device:   OpenCL device descriptor (see README), ignored by C++
+//             networks, defaults to "0" if NULL
+// OpenCL networks can only be loaded once at a time in a process
+ngen_network *ngen_load(const char *model, unsigned platform,
+                        const char *device);
+
+// get size (in bytes) of an input
+size_t ngen_input_size(const ngen_network *net);
+
+// get number of outputs (floats) of an input
+size_t ngen_output_size(const ngen_network *net);
+
+// infer on an input, returns zero if succeeded
+int ngen_infer(ngen_network *net, const void *input, float *output);
+
+// infer on `count` contiguous inputs, returns zero if succeeded
+int ngen_infer_batch(ngen_network *net, const void *inputs, size_t count,
+                     float *outputs);
+
+// batch concurrent `ngen_infer` calls on the network, a batch is run
+// once `max_batch` calls are queued, or the oldest call has waited for
+// `timeout_us` microseconds, returns zero if succeeded
+// batching is disabled if `max_batch` is less than 2 (the default)
+int ngen_set_batching(ngen_network *net, size_t max_batch,
+                      unsigned timeout_us);
+
+// release the specific network
+void ngen_free(ngen_network *net);
+
+// enable the result cache shared by all networks of the library, with
+// the specific memory budget in bytes, or disable it if `bytes` is zero,
+// returns zero if succeeded, cached results are dropped, fails if the
+// budget can not hold an entry for each of the 16 lock stripes
+int ngen_cache_init(size_t bytes);
+
+// get number of hits & misses of the result cache, pointers may be NULL
+void ngen_cache_stats(uint64_t *hits, uint64_t *misses);
+
+// get message of the last error occurred in the current thread
+const char *ngen_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // NEURALGEN_NGEN_H_
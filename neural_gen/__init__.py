@@ -6,7 +6,10 @@ def main() -> None:
   import argparse
   import json
   from neural_gen.network import from_dict
+  from neural_gen.model import read_model
   from neural_gen.generator import CppGenerator, OpenCLGenerator
+  from neural_gen.tuner import TuningDB, Tuner, OpenCLTuner, cpu_identity
+  import platform
 
   # initialize parser
   parser = argparse.ArgumentParser(prog='neural_gen')
@@ -16,27 +19,143 @@ def main() -> None:
   parser.add_argument('descriptor', type=str,
                       help='neural network descriptor (json)')
   parser.add_argument('-g', '--gen', default='cpp', type=str,
-                      help='type of generator (cpp/opencl), default to "cpp"')
+                      help='type of generator (cpp/opencl/opencl-opt/hetero/\n' +
+                      'hetero-opt), default to "cpp", heterogeneous\n' +
+                      'generators place layers on host or OpenCL device')
   parser.add_argument('-o', '--output', type=str,
                       help='file name of generated code')
+  parser.add_argument('-b', '--batch', default=1, type=int,
+                      help='batch size of OpenCL generators, default to 1')
+  parser.add_argument('--fused', action='store_true',
+                      help='run the whole network in a single kernel,\n' +
+                      'only supported by the OpenCL generator')
+  parser.add_argument('--host-layers', type=str,
+                      help='comma-separated IDs of layers placed on host by\n' +
+                      'heterogeneous generators, estimated by default')
+  parser.add_argument('-m', '--model', type=str,
+                      help='model file to be embedded in generated code,\n' +
+                      'only supported by the C++ generator')
+  parser.add_argument('-s', '--sparsity', default=0.5, type=float,
+                      help='sparsity threshold of embedded layers to use\n' +
+                      'sparse kernels, default to 0.5')
+  parser.add_argument('--grain', default=65536, type=int,
+                      help='minimum estimated work (FLOPs) per OpenMP\n' +
+                      'thread of layers in C++ code, default to 65536')
+  parser.add_argument('-t', '--tuning', type=str,
+                      help='tuning database of the C++ generator, tuned\n' +
+                      'configurations of layers on the local CPU are used,\n' +
+                      'also used by heterogeneous generators, and by tiled\n' +
+                      'OpenCL generators for the selected device')
+  parser.add_argument('--tune', action='store_true',
+                      help='benchmark candidate configurations of layers on\n' +
+                      'the local CPU (or tiled kernels on the selected\n' +
+                      'device), and record the fastest ones to the\n' +
+                      'tuning database')
+  parser.add_argument('--tune-cxx', type=str,
+                      default='g++ -std=c++17 -O3 -fopenmp -march=native',
+                      help='command for compiling benchmarks of tuning,\n' +
+                      'default to "%(default)s"')
+  parser.add_argument('--tune-cl-cxx', type=str,
+                      default='g++ -std=c++17 -O2',
+                      help='command for compiling OpenCL benchmarks of\n' +
+                      'tuning, default to "%(default)s"')
+  parser.add_argument('--tune-cl-libs', type=str,
+                      default='-framework OpenCL'
+                      if platform.system() == 'Darwin' else '-lOpenCL',
+                      help='libraries linked to OpenCL benchmarks of\n' +
+                      'tuning, default to "%(default)s"')
+  parser.add_argument('--tune-platform', default=0, type=int,
+                      help='OpenCL platform ID of the tuned device,\n' +
+                      'default to 0')
+  parser.add_argument('--tune-device', default='0', type=str,
+                      help='descriptor of the tuned device (N/all/cpu/gpu/\n' +
+                      'acc), default to "0"')
   parser.add_argument('-v', '--version', action='version',
                       version=f'%(prog)s {__version__}')
 
   # parse arguments
   args = parser.parse_args()
-  if not args.descriptor or not args.output:
+  if not args.descriptor or not (args.output or args.tune):
     parser.print_help()
     exit(1)
+  if args.batch < 1:
+    parser.error('batch size must be at least 1')
+  if args.grain < 1:
+    parser.error('grain of OpenMP threads must be at least 1')
+  if args.model and args.gen != 'cpp':
+    parser.error('only the C++ generator supports embedding models')
+  hetero = args.gen in ('hetero', 'hetero-opt')
+  tiled = args.gen in ('opencl-opt', 'hetero-opt')
+  if args.tuning and args.gen != 'cpp' and not hetero and not tiled:
+    parser.error('only C++, tiled OpenCL and heterogeneous generators ' +
+                 'support tuning')
+  if args.host_layers and not hetero:
+    parser.error('only heterogeneous generators support placing layers')
+  if args.fused and args.gen != 'opencl':
+    parser.error('only the OpenCL generator supports fused kernels')
+  if args.tune and not args.tuning:
+    parser.error('tuning database is not specified')
 
   # load network
   with open(args.descriptor, 'r') as f:
     network = from_dict(json.load(f))
 
+  # parse layers placed on host
+  host_layers = None
+  if args.host_layers is not None:
+    try:
+      host_layers = [int(i) for i in args.host_layers.split(',') if i]
+    except ValueError:
+      parser.error('invalid layer IDs')
+    if any(i < 1 or i >= len(network.layers) for i in host_layers):
+      parser.error('layer ID out of range')
+
+  # load model to be embedded
+  model = read_model(args.model) if args.model else None
+
+  # tune layers and load tuned configurations
+  tuning = None
+  device_tuning = None
+  if args.tuning:
+    db = TuningDB(args.tuning)
+    if args.gen != 'opencl-opt':
+      identity = cpu_identity()
+      if args.tune:
+        configs = Tuner(args.tune_cxx).tune(network)
+        for key, config in configs.items():
+          print(f'{key}: {config}')
+        db.update(identity, configs)
+      tuning = db.configs(identity)
+    # the device is probed only if it is tuned or may have been tuned
+    if tiled and (args.tune or any(i.startswith('OpenCL ')
+                                   for i in db.identities())):
+      tuner = OpenCLTuner(args.tune_cl_cxx, args.tune_cl_libs,
+                          args.tune_platform, args.tune_device)
+      if args.tune:
+        identity, configs = tuner.tune(network, args.batch)
+        for key, config in configs.items():
+          print(f'{key}: {config}')
+        db.update(identity, configs)
+      else:
+        identity = tuner.identity(network)
+      device_tuning = db.configs(identity)
+    if args.tune:
+      db.save()
+  if not args.output:
+    return
+
   # generate code
   gen = {
-      'cpp': CppGenerator,
-      'opencl': lambda: OpenCLGenerator(False),
-      'opencl-opt': lambda: OpenCLGenerator(True),
+      'cpp': lambda: CppGenerator(model, args.sparsity, args.grain, tuning),
+      'opencl': lambda: OpenCLGenerator(False, args.batch,
+                                        fused=args.fused),
+      'opencl-opt': lambda: OpenCLGenerator(
+          True, args.batch, device_tuning=device_tuning),
+      'hetero': lambda: OpenCLGenerator(False, args.batch, True, tuning,
+                                        host_layers),
+      'hetero-opt': lambda: OpenCLGenerator(True, args.batch, True, tuning,
+                                            host_layers,
+                                            device_tuning=device_tuning),
   }[args.gen]()
   gen.generate(network)
   with open(args.output, 'w') as f:
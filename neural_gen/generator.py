@@ -1,7 +1,9 @@
-from typing import TextIO
+from typing import TextIO, Tuple, List, Optional, Dict, Any, Set, Callable
 from neural_gen.layer import Layer, Input, Convolution, Pooling, FullConnection
 from neural_gen.network import Network
+from neural_gen.model import LayerData
 from os import path
+import io
 
 
 class Generator:
@@ -35,6 +37,125 @@ class Generator:
     with open(path.join(Generator.__TEMPLATE_DIR, gen, name), 'r') as f:
       return f.read()
 
+  @staticmethod
+  def _max_divisor(n: int, limit: int) -> int:
+    '''
+    Get the maximum divisor of `n` that is not greater than `limit`.
+    '''
+    for i in range(min(n, max(limit, 1)), 0, -1):
+      if n % i == 0:
+        return i
+    return 1
+
+  @staticmethod
+  def _layer_cost(layer: Layer, last_layer: Layer) -> int:
+    '''
+    Estimate the cost (number of multiply-accumulates) of a layer.
+    '''
+    if isinstance(layer, Convolution):
+      kernel = layer['kernel']['width'] * layer['kernel']['height']
+      return layer.get_output_size() * kernel * \
+          last_layer.get_output_shape()[2] // layer['groups']
+    if isinstance(layer, Pooling):
+      kernel = layer['kernel']['width'] * layer['kernel']['height']
+      return layer.get_output_size() * kernel
+    if isinstance(layer, FullConnection):
+      return layer.get_output_size() * last_layer.get_output_size()
+    return 0
+
+  @staticmethod
+  def _layer_bytes(layer: Layer, last_layer: Layer) -> int:
+    '''
+    Estimate the memory traffic (bytes of weights, inputs and outputs)
+    of a layer.
+    '''
+    if isinstance(layer, Convolution):
+      kernel = layer['kernel']['width'] * layer['kernel']['height']
+      weights = kernel * last_layer.get_output_shape()[2] * \
+          layer['output']['depth'] // layer['groups']
+    elif isinstance(layer, Pooling):
+      weights = layer['output']['depth']
+    elif isinstance(layer, FullConnection):
+      weights = layer.get_output_size() * last_layer.get_output_size()
+    else:
+      return 0
+    floats = weights + last_layer.get_output_size() + layer.get_output_size()
+    return floats * 4
+
+  @staticmethod
+  def _param_sizes(layer: Layer, last_layer: Layer) -> Tuple[int, int]:
+    '''
+    Get numbers of weights and biases of a layer.
+    '''
+    weights = Generator._layer_bytes(layer, last_layer) // 4 - \
+        last_layer.get_output_size() - layer.get_output_size()
+    return weights, layer.get_output_shape()[2]
+
+  @staticmethod
+  def _layer_key(layer: Layer, last_layer: Layer) -> str:
+    '''
+    Get key of a layer in tuning databases, layers with the same key
+    run the same code.
+    '''
+    width, height, depth = last_layer.get_output_shape()
+    key = f'{layer.layer_type()} {width}x{height}x{depth}'
+    if isinstance(layer, (Convolution, Pooling)):
+      key += f' k{layer["kernel"]["width"]}x{layer["kernel"]["height"]}'
+      key += f' s{layer["stride"]}'
+    if isinstance(layer, Convolution) and layer['groups'] > 1:
+      key += f' g{layer["groups"]}'
+    if isinstance(layer, Pooling):
+      key += f' {layer["function"]}'
+    width, height, depth = layer.get_output_shape()
+    key += f' -> {width}x{height}x{depth}'
+    if isinstance(last_layer, Input) and last_layer.is_raw():
+      width, height, depth = last_layer.get_raw_shape()
+      key += f' raw {last_layer["element"]} {width}x{height}x{depth}'
+    return key
+
+  @staticmethod
+  def _gen_groups(layer: Convolution, last_layer: Layer) -> str:
+    '''
+    Generate definitions of a grouped convolution layer.
+    '''
+    groups = layer['groups']
+    if last_layer.get_output_shape()[2] % groups:
+      raise ValueError('input depth must be a multiple of groups')
+    return f'#define GROUPS {groups}\n' if groups > 1 else ''
+
+  @staticmethod
+  def _is_depthwise_3x3(layer: Convolution, last_layer: Layer) -> bool:
+    '''
+    Check if a convolution layer is a depthwise 3x3 convolution that reads
+    float inputs, which runs a specialized kernel.
+    '''
+    depth = last_layer.get_output_shape()[2]
+    return layer['groups'] == depth == layer['output']['depth'] and \
+        layer['kernel']['width'] == layer['kernel']['height'] == 3 and \
+        not (isinstance(last_layer, Input) and last_layer.is_raw())
+
+  @staticmethod
+  def _gen_raw_input(last_layer: Layer, types: Dict[str, str]) -> str:
+    '''
+    Generate definitions of the raw input if `last_layer` is a raw
+    input layer, `types` maps element types to types in generated code.
+    '''
+    if not isinstance(last_layer, Input) or not last_layer.is_raw():
+      return ''
+    if last_layer['element'] not in types:
+      raise ValueError(f'unsupported input element "{last_layer["element"]}"')
+    width, height, depth = last_layer.get_raw_shape()
+    code = '#define RAW_INPUT\n'
+    code += f'#define RAW_INPUT_TYPE {types[last_layer["element"]]}\n'
+    code += f'#define RAW_WIDTH {width}\n'
+    code += f'#define RAW_HEIGHT {height}\n'
+    code += f'#define RAW_DEPTH {depth}\n'
+    code += f'#define INPUT_PAD_X {last_layer["padding"]["x"]}\n'
+    code += f'#define INPUT_PAD_Y {last_layer["padding"]["y"]}\n'
+    code += f'#define INPUT_SCALE {float(last_layer["scale"])!r}f\n'
+    code += f'#define INPUT_OFFSET {float(last_layer["offset"])!r}f\n'
+    return code
+
 
 class CppGenerator(Generator):
   '''
@@ -51,15 +172,249 @@ class CppGenerator(Generator):
       'full_connection': 'FULL_CONN',
   }
 
-  def __init__(self) -> None:
+  '''
+  Types (in generated C++ code) of raw input elements.
+  '''
+  __RAW_TYPE = {
+      'float': 'float',
+      'uint8': 'uint8_t',
+      'int8': 'int8_t',
+  }
+
+  '''
+  Number of values per line of embedded arrays.
+  '''
+  __VALUES_PER_LINE = 8
+
+  '''
+  Candidates of block sizes (number of outputs) of sparse
+  fully connection layers.
+  '''
+  __SPARSE_BLOCKS = (8, 4, 1)
+
+  '''
+  Cost of moving a byte in FLOPs, for estimating work of layers.
+  '''
+  __BYTE_COST = 1
+
+  '''
+  Minimum number of outer loop iterations per thread to parallelize only
+  the outer loop of a layer.
+  '''
+  __MIN_OUTER_ITERS = 4
+
+  def __init__(self, model: Optional[List[LayerData]] = None,
+               sparsity: float = 0.5, grain: int = 65536,
+               tuning: Optional[Dict[str, Dict[str, Any]]] = None) -> None:
     # generated code
     self.__code = ''
+    # model data to be embedded
+    self.__model = model
+    # layers with sparsity not less than the threshold use sparse kernels
+    self.__sparsity = sparsity
+    # block sizes of layers with sparse weights (`None` if not blocked)
+    self.__sparse_blocks = {}
+    # ratios of stored weights of layers with sparse weights
+    self.__densities = {}
+    # minimum estimated work (FLOPs) per OpenMP thread of a layer
+    self.__grain = grain
+    # tuned configurations of layers, keyed by layer keys
+    self.__tuning = tuning or {}
+    # configurations of layers to be generated, keyed by layer IDs
+    self.__configs = {}
     # load templates
     self.__define = Generator._read_template('cpp', 'define.h')
     self.__main = Generator._read_template('cpp', 'main.cpp')
     self.__convolution = Generator._read_template('cpp', 'convolution.cpp')
     self.__pooling = Generator._read_template('cpp', 'pooling.cpp')
     self.__fullconn = Generator._read_template('cpp', 'fullconn.cpp')
+    self.__bench = Generator._read_template('cpp', 'bench.cpp')
+
+  @staticmethod
+  def __gen_array(name: str, data: Tuple[float, ...]) -> str:
+    '''
+    Generate an aligned constexpr float array.
+    '''
+    values = []
+    for x in data:
+      # 9 significant digits are enough to represent a float exactly
+      v = f'{x:.9g}'
+      if v.lstrip('-').isdigit():
+        v += '.0'
+      values.append(f'{v}f')
+    return CppGenerator.__gen_values(name, 'float', values)
+
+  @staticmethod
+  def __gen_index_array(name: str, data: List[int]) -> str:
+    '''
+    Generate an aligned constexpr index array.
+    '''
+    return CppGenerator.__gen_values(name, 'uint32_t', list(map(str, data)))
+
+  @staticmethod
+  def __gen_values(name: str, elem_type: str, values: List[str]) -> str:
+    '''
+    Generate an aligned constexpr array of the specific values.
+    '''
+    # arrays can not be empty
+    values = values or ['0']
+    n = CppGenerator.__VALUES_PER_LINE
+    lines = [', '.join(values[i:i + n]) for i in range(0, len(values), n)]
+    body = ',\n    '.join(lines)
+    return f'alignas(64) static constexpr {elem_type} {name}[] = ' + \
+        f'{{\n    {body}}};\n'
+
+  @staticmethod
+  def __sparse_conv(layer: Convolution, last_layer: Layer,
+                    weight: Tuple[float, ...]) -> Tuple[List[int], ...]:
+    '''
+    Compress weights of a convolution layer in CSR format, rows are output
+    channels, and column indices are offsets of the corresponding inputs.
+
+    Returns row pointers, column indices and values.
+    '''
+    in_width, in_height, in_depth = last_layer.get_output_shape()
+    kw, kh = layer['kernel']['width'], layer['kernel']['height']
+    # input & output channels of each group
+    group_in = in_depth // layer['groups']
+    group_out = layer['output']['depth'] // layer['groups']
+    ptr, idx, values = [0], [], []
+    for channel in range(layer['output']['depth']):
+      first = channel // group_out * group_in
+      for inc in range(group_in):
+        for wy in range(kh):
+          for wx in range(kw):
+            w = weight[((channel * group_in + inc) * kh + wy) * kw + wx]
+            if w != 0:
+              idx.append(((first + inc) * in_height + wy) * in_width + wx)
+              values.append(w)
+      ptr.append(len(idx))
+    return ptr, idx, values
+
+  @staticmethod
+  def __sparse_fc(layer: FullConnection, last_layer: Layer,
+                  weight: Tuple[float, ...], block: int) -> Tuple[List[int], ...]:
+    '''
+    Compress weights of a fully connection layer in block-sparse format,
+    each block contains weights of `block` consecutive outputs from
+    an input. Rows are output blocks, column indices are inputs.
+
+    Returns row pointers, column indices and values.
+    '''
+    in_size = last_layer.get_output_size()
+    out_size = layer['output_size']
+    ptr, idx, values = [0], [], []
+    for first in range(0, out_size, block):
+      for c in range(in_size):
+        row = weight[c * out_size + first:c * out_size +
+                     min(first + block, out_size)]
+        if any(row):
+          idx.append(c)
+          values.extend(row)
+          values.extend([0.0] * (block - len(row)))
+      ptr.append(len(idx))
+    return ptr, idx, values
+
+  def __gen_sparse(self, layer_id: int, layer: Layer, last_layer: Layer,
+                   weight: Tuple[float, ...]) -> Optional[str]:
+    '''
+    Generate sparse weights of a layer if its sparsity reaches
+    the threshold, returns `None` if the layer should use dense weights.
+    '''
+    if isinstance(last_layer, Input) and last_layer.is_raw():
+      return None
+    zeros = sum(1 for w in weight if w == 0)
+    if not weight or zeros / len(weight) < self.__sparsity:
+      return None
+    if isinstance(layer, Convolution):
+      block = None
+      ptr, idx, values = CppGenerator.__sparse_conv(layer, last_layer, weight)
+    elif isinstance(layer, FullConnection):
+      # pick the block size with the smallest footprint
+      sparse = [(b, CppGenerator.__sparse_fc(layer, last_layer, weight, b))
+                for b in CppGenerator.__SPARSE_BLOCKS]
+      block, (ptr, idx, values) = min(
+          sparse, key=lambda x: len(x[1][1]) + len(x[1][2]))
+    else:
+      return None
+    self.__sparse_blocks[layer_id] = block
+    self.__densities[layer_id] = len(values) / len(weight)
+    code = CppGenerator.__gen_index_array(
+        f'EMBEDDED_SPARSE_PTR({layer_id})', ptr)
+    code += CppGenerator.__gen_index_array(
+        f'EMBEDDED_SPARSE_IDX({layer_id})', idx)
+    code += CppGenerator.__gen_array(f'EMBEDDED_WEIGHT({layer_id})', values)
+    return code
+
+  def __gen_sparse_defs(self, layer_id: int) -> str:
+    '''
+    Generate definitions of layers with sparse weights.
+    '''
+    if layer_id not in self.__sparse_blocks:
+      return ''
+    code = '#define SPARSE_WEIGHT\n'
+    block = self.__sparse_blocks[layer_id]
+    if block is not None:
+      code += f'#define SPARSE_BLOCK {block}\n'
+    return code
+
+  def __gen_model(self, network: Network) -> None:
+    '''
+    Generate embedded weights & biases of all layers.
+    '''
+    if len(self.__model) != len(network.layers):
+      raise ValueError('layer number mismatch between model and network')
+    self.__code += '#define EMBEDDED_MODEL\n\n'
+    self.__sparse_blocks = {}
+    self.__densities = {}
+    for i, layer in enumerate(network.layers):
+      if not CppGenerator.__LAYER_TYPE[layer.layer_type()]:
+        continue
+      weight, bias = self.__model[i]
+      if not weight or not bias:
+        raise ValueError(f'layer {i} has no weight or bias in model')
+      sparse = self.__gen_sparse(i, layer, network.layers[i - 1], weight)
+      if sparse is None:
+        self.__code += CppGenerator.__gen_array(f'EMBEDDED_WEIGHT({i})', weight)
+      else:
+        self.__code += sparse
+      self.__code += CppGenerator.__gen_array(f'EMBEDDED_BIAS({i})', bias)
+    self.__code += '\n'
+
+  def __gen_parallel(self, layer_id: int, layer: Layer,
+                     last_layer: Layer) -> str:
+    '''
+    Generate the parallelization strategy of a layer: the number of
+    OpenMP threads (run serially if less than 2), whether to parallelize
+    only the outer loop or the collapsed loops, and the unroll factor of
+    the loop over inputs.
+
+    Tuned configurations are used if available, otherwise the strategy is
+    estimated from the work of the layer.
+    '''
+    config = self.__configs.get(layer_id)
+    if config is not None and layer_id not in self.__sparse_blocks:
+      code = f'#define PARALLEL_THREADS {config["threads"]}\n'
+      if config['threads'] > 1 and config['outer']:
+        code += '#define PARALLEL_OUTER\n'
+      if config['unroll'] > 1:
+        code += f'#define LAYER_UNROLL {config["unroll"]}\n'
+      return code
+    density = self.__densities.get(layer_id, 1)
+    flops = 2 * Generator._layer_cost(layer, last_layer) * density
+    work = flops + CppGenerator.__BYTE_COST * \
+        Generator._layer_bytes(layer, last_layer)
+    if isinstance(layer, FullConnection):
+      block = self.__sparse_blocks.get(layer_id) or 1
+      outer = inner = -(-layer.get_output_size() // block)
+    else:
+      outer = layer['output']['depth']
+      inner = layer.get_output_size()
+    threads = min(int(work // self.__grain), inner)
+    code = f'#define PARALLEL_THREADS {threads}\n'
+    if threads > 1 and outer >= threads * CppGenerator.__MIN_OUTER_ITERS:
+      code += '#define PARALLEL_OUTER\n'
+    return code
 
   def __gen_input(self, layer_id: int, layer: Input, last_layer: Layer) -> None:
     '''
@@ -84,7 +439,15 @@ class CppGenerator(Generator):
     self.__code += f'#define OUTPUT_WIDTH {layer["output"]["width"]}\n'
     self.__code += f'#define OUTPUT_HEIGHT {layer["output"]["height"]}\n'
     self.__code += f'#define OUTPUT_DEPTH {layer["output"]["depth"]}\n'
-    self.__code += f'#define ACTIVATION {layer["activation"]}\n\n'
+    self.__code += f'#define ACTIVATION {layer["activation"]}\n'
+    self.__code += Generator._gen_raw_input(last_layer, CppGenerator.__RAW_TYPE)
+    self.__code += Generator._gen_groups(layer, last_layer)
+    if Generator._is_depthwise_3x3(layer, last_layer) and \
+            layer_id not in self.__sparse_blocks:
+      self.__code += '#define DEPTHWISE_3X3\n'
+    self.__code += self.__gen_sparse_defs(layer_id)
+    self.__code += self.__gen_parallel(layer_id, layer, last_layer)
+    self.__code += '\n'
     self.__code += f'{self.__convolution}\n'
 
   def __gen_pooling(self, layer_id: int, layer: Pooling, last_layer: Layer) -> None:
@@ -104,7 +467,10 @@ class CppGenerator(Generator):
     self.__code += f'#define OUTPUT_WIDTH {layer["output"]["width"]}\n'
     self.__code += f'#define OUTPUT_HEIGHT {layer["output"]["height"]}\n'
     self.__code += f'#define OUTPUT_DEPTH {layer["output"]["depth"]}\n'
-    self.__code += f'#define ACTIVATION {layer["activation"]}\n\n'
+    self.__code += f'#define ACTIVATION {layer["activation"]}\n'
+    self.__code += Generator._gen_raw_input(last_layer, CppGenerator.__RAW_TYPE)
+    self.__code += self.__gen_parallel(layer_id, layer, last_layer)
+    self.__code += '\n'
     self.__code += f'{self.__pooling}\n'
 
   def __gen_full_conn(self, layer_id: int, layer: FullConnection, last_layer: Layer) -> None:
@@ -116,7 +482,11 @@ class CppGenerator(Generator):
     self.__code += f'#define LAYER_ID {layer_id}\n'
     self.__code += f'#define INPUT_SIZE {last_size}\n'
     self.__code += f'#define OUTPUT_SIZE {size}\n'
-    self.__code += f'#define ACTIVATION {layer["activation"]}\n\n'
+    self.__code += f'#define ACTIVATION {layer["activation"]}\n'
+    self.__code += Generator._gen_raw_input(last_layer, CppGenerator.__RAW_TYPE)
+    self.__code += self.__gen_sparse_defs(layer_id)
+    self.__code += self.__gen_parallel(layer_id, layer, last_layer)
+    self.__code += '\n'
     self.__code += f'{self.__fullconn}\n'
 
   def generate(self, network: Network) -> None:
@@ -128,19 +498,88 @@ class CppGenerator(Generator):
       if layer_type:
         layer_desc.append(f'e({layer_type}, {i}, {layer.get_output_size()})')
     self.__code += f'#define NETWORK_LAYERS(e) {" ".join(layer_desc)}\n'
-    self.__code += f'#define OUTPUT_SIZE {network.layers[-1].get_output_size()}\n\n'
+    costs = []
+    for i, layer in enumerate(network.layers[1:], 1):
+      cost = Generator._layer_cost(layer, network.layers[i - 1])
+      costs.append(f'e({i}, {cost})')
+    self.__code += f'#define NETWORK_COSTS(e) {" ".join(costs)}\n'
+    self.__code += f'#define OUTPUT_SIZE {network.layers[-1].get_output_size()}\n'
+    input_type = CppGenerator.__RAW_TYPE[network.layers[0]['element']]
+    self.__code += f'#define INPUT_TYPE {input_type}\n'
+    self.__code += f'#define INPUT_SIZE {network.layers[0].get_raw_size()}\n\n'
     self.__code += f'{self.__define}\n'
+    if self.__model is not None:
+      self.__gen_model(network)
     self.__code += f'{self.__main}\n'
+    self.__pick_configs(network)
     # generate all layers
+    for i, layer in enumerate(network.layers):
+      self.__gen_layer(i, layer, network.layers[i - 1] if i - 1 >= 0 else None)
+
+  def generate_layers(self, network: Network, layer_ids: List[int]) -> None:
+    '''
+    Generate only the specific layers (without the runtime), as functions
+    called by host code of other generators.
+    '''
+    self.__code = f'{self.__define}\n'
+    self.__sparse_blocks = {}
+    self.__densities = {}
+    self.__pick_configs(network)
+    for i in layer_ids:
+      self.__gen_layer(i, network.layers[i], network.layers[i - 1])
+
+  def __pick_configs(self, network: Network) -> None:
+    '''
+    Pick tuned configurations of all layers of the specific network.
+    '''
+    self.__configs = {}
+    for i, layer in enumerate(network.layers[1:], 1):
+      key = Generator._layer_key(layer, network.layers[i - 1])
+      if key in self.__tuning:
+        self.__configs[i] = self.__tuning[key]
+
+  def generate_bench(self, network: Network,
+                     variants: List[Tuple[int, Dict[str, Any]]],
+                     repeats: int) -> None:
+    '''
+    Generate a benchmark of layer variants, `variants` contains indices
+    of layers and their configurations. The benchmark prints the median
+    time (in nanoseconds) of `repeats` runs of each variant.
+    '''
+    self.__code = '#define GENERATED\n\n'
+    self.__configs = {}
+    self.__sparse_blocks = {}
+    bench_desc = []
+    for k, (i, config) in enumerate(variants):
+      layer, last_layer = network.layers[i], network.layers[i - 1]
+      layer_type = CppGenerator.__LAYER_TYPE[layer.layer_type()]
+      # variant IDs are pp-numbers like `1_0`
+      variant_id = f'{i}_{k}'
+      self.__configs[variant_id] = config
+      weight_size, bias_size = Generator._param_sizes(layer, last_layer)
+      bench_desc.append(f'e({layer_type}, {variant_id}, '
+                        f'{last_layer.get_output_size()}, '
+                        f'{layer.get_output_size()}, {weight_size}, '
+                        f'{bias_size})')
+    self.__code += f'#define BENCH_VARIANTS(e) {" ".join(bench_desc)}\n'
+    self.__code += f'#define BENCH_REPEATS {repeats}\n\n'
+    self.__code += f'{self.__define}\n'
+    self.__code += f'{self.__bench}\n'
+    for variant_id, (i, _) in zip(self.__configs, variants):
+      self.__gen_layer(variant_id, network.layers[i], network.layers[i - 1])
+
+  def __gen_layer(self, layer_id: Any, layer: Layer,
+                  last_layer: Optional[Layer]) -> None:
+    '''
+    Generate a layer, `layer_id` is the ID of layer in generated code.
+    '''
     layer_gen = {
         'input': self.__gen_input,
         'convolution': self.__gen_conv,
         'pooling': self.__gen_pooling,
         'full_connection': self.__gen_full_conn,
     }
-    for i, layer in enumerate(network.layers):
-      layer_gen[layer.layer_type()](
-          i, layer, network.layers[i - 1] if i - 1 >= 0 else None)
+    layer_gen[layer.layer_type()](layer_id, layer, last_layer)
 
   def dump(self, f: TextIO) -> None:
     f.write(self.__code)
@@ -161,16 +600,102 @@ class OpenCLGenerator(Generator):
       'full_connection': 'FULL_CONN',
   }
 
-  def __init__(self, opt: bool) -> None:
+  '''
+  Types (in OpenCL C and host code) of raw input elements.
+  '''
+  __RAW_TYPE = {
+      'float': 'float',
+      'uint8': 'uchar',
+      'int8': 'char',
+  }
+  __RAW_HOST_TYPE = {
+      'float': 'float',
+      'uint8': 'uint8_t',
+      'int8': 'int8_t',
+  }
+
+  '''
+  Limitations of tiled kernels.
+  '''
+  __MAX_GROUP_SIZE = 256
+  __MAX_LOCAL_FLOATS = 4096
+  __MAX_TILE_SIZE = 16
+  __MAX_CHANNEL_BLOCK = 8
+  __MAX_LOCAL_CHANNELS = 64
+  __MIN_WORK_ITEMS = 512
+  __MAX_REDUCE_SIZE = 64
+  __TILE_DEPTH = 32
+
+  '''
+  Names of parameters of tiled kernels in tuned configurations, the inner
+  group of fully connection layers is the reduction size for GEMV, or
+  the batch group for GEMM.
+  '''
+  __CONV_PARAMS = ('tile_width', 'tile_height', 'channel_block',
+                   'local_channels', 'input_block')
+  __LOCAL_PARAMS = ('local_height', 'local_width')
+  __FC_PARAMS = ('output_group', 'inner_group')
+
+  '''
+  Limitation of local memory (floats) of the fused kernel.
+  '''
+  __MAX_FUSED_LOCAL_FLOATS = 8192
+
+  '''
+  Estimated performance for placing layers of heterogeneous networks:
+  throughput (FLOPs per second) of host and device, time (seconds) of
+  launching a kernel and starting a transfer, and bandwidth (bytes per
+  second) of transfers.
+  '''
+  __HOST_FLOPS = 2e10
+  __DEVICE_FLOPS = 2e11
+  __LAUNCH_TIME = 1e-5
+  __TRANSFER_TIME = 2e-5
+  __TRANSFER_BANDWIDTH = 5e9
+
+  '''
+  Bytes of raw input elements.
+  '''
+  __RAW_BYTES = {
+      'float': 4,
+      'uint8': 1,
+      'int8': 1,
+  }
+
+  def __init__(self, opt: bool, batch: int = 1, hetero: bool = False,
+               tuning: Optional[Dict[str, Dict[str, Any]]] = None,
+               host_layers: Optional[List[int]] = None,
+               fused: bool = False,
+               device_tuning: Optional[Dict[str, Dict[str, Any]]] = None) -> None:
     self.__opt = opt
+    self.__batch = batch
+    # run the whole network in a single kernel
+    self.__fused = fused
+    # place layers on host or device (heterogeneous network)
+    self.__hetero = hetero
+    # tuned configurations of C++ layers, keyed by layer keys
+    self.__tuning = tuning or {}
+    # IDs of layers placed on host, estimated if not specified
+    self.__host_layers = host_layers
+    # tuned configurations of tiled kernels on the device, keyed by device
+    # layer keys
+    self.__device_tuning = device_tuning or {}
+    # configurations of tiled kernels to be generated, keyed by layer IDs
+    self.__configs = {}
     # generated code
     self.__code = ''
+    # work sizes (id, global, local) of layers with tiled kernels
+    self.__work_sizes = []
+    # ID of the last layer
+    self.__last_id = 0
     # load templates
     self.__main = Generator._read_template('opencl', 'main.cpp')
     self.__define = Generator._read_template('opencl', 'define.cl')
     self.__convolution = Generator._read_template('opencl', 'convolution.cl')
     self.__pooling = Generator._read_template('opencl', 'pooling.cl')
     self.__fullconn = Generator._read_template('opencl', 'fullconn.cl')
+    self.__network = Generator._read_template('opencl', 'network.cl')
+    self.__bench = Generator._read_template('opencl', 'bench.cpp')
 
   def __gen_input(self, layer_id: int, layer: Input, last_layer: Layer) -> None:
     '''
@@ -195,8 +720,107 @@ class OpenCLGenerator(Generator):
     self.__code += f'#define OUTPUT_WIDTH {layer["output"]["width"]}\n'
     self.__code += f'#define OUTPUT_HEIGHT {layer["output"]["height"]}\n'
     self.__code += f'#define OUTPUT_DEPTH {layer["output"]["depth"]}\n'
-    self.__code += f'#define ACTIVATION {layer["activation"]}\n\n'
-    self.__code += f'{self.__convolution}\n'
+    self.__code += f'#define ACTIVATION {layer["activation"]}\n'
+    self.__code += Generator._gen_raw_input(
+        last_layer, OpenCLGenerator.__RAW_TYPE)
+    self.__code += self.__gen_spaces(layer_id)
+    self.__code += Generator._gen_groups(layer, last_layer)
+    if self.__opt and not self.__fused and \
+            Generator._is_depthwise_3x3(layer, last_layer):
+      # each work-item computes 4 adjacent outputs of a channel
+      self.__code += '#define DEPTHWISE_3X3\n'
+      lh, lw = self.__tuned(
+          layer_id, OpenCLGenerator.__LOCAL_PARAMS,
+          lambda: OpenCLGenerator.__depthwise_tiling(layer))
+      width, height, depth = layer.get_output_shape()
+      vecs = -(-width // 4)
+      global_size = (depth * self.__batch, -(-height // lh) * lh,
+                     -(-vecs // lw) * lw)
+      self.__work_sizes.append((layer_id, global_size, (1, lh, lw)))
+    elif self.__opt and not self.__fused:
+      tw, th, cb, lc, ib = self.__tuned(
+          layer_id, OpenCLGenerator.__CONV_PARAMS,
+          lambda: OpenCLGenerator.__conv_tiling(layer, last_layer))
+      self.__code += f'#define TILE_WIDTH {tw}\n'
+      self.__code += f'#define TILE_HEIGHT {th}\n'
+      self.__code += f'#define CHANNEL_BLOCK {cb}\n'
+      self.__code += f'#define LOCAL_CHANNELS {lc}\n'
+      self.__code += f'#define INPUT_BLOCK {ib}\n'
+      width, height, depth = layer.get_output_shape()
+      global_size = (-(-depth // (cb * lc)) * lc * self.__batch,
+                     -(-height // th) * th, -(-width // tw) * tw)
+      self.__work_sizes.append((layer_id, global_size, (lc, th, tw)))
+    self.__code += f'\n{self.__convolution}\n'
+
+  def __tuned(self, layer_id: Any, params: Tuple[str, ...],
+              default: Callable[[], Tuple[int, ...]]) -> Tuple[int, ...]:
+    '''
+    Get the specific parameters of a tiled kernel from the tuned
+    configuration of a layer, or from `default` if it is not tuned.
+    '''
+    config = self.__configs.get(layer_id)
+    if config is None or any(p not in config for p in params):
+      return default()
+    return tuple(config[p] for p in params)
+
+  @staticmethod
+  def __depthwise_tiling(layer: Convolution) -> Tuple[int, int]:
+    '''
+    Pick work-group shape of the depthwise 3x3 kernel, each work-item
+    computes 4 adjacent outputs of a row.
+
+    Returns numbers of work-items along the height and the width.
+    '''
+    width, height, _ = layer.get_output_shape()
+    lw = min(-(-width // 4), OpenCLGenerator.__MAX_TILE_SIZE)
+    lh = min(height, OpenCLGenerator.__MAX_GROUP_SIZE // lw)
+    return lh, lw
+
+  @staticmethod
+  def __conv_tiling(layer: Convolution, last_layer: Layer) -> Tuple[int, ...]:
+    '''
+    Pick tile sizes of the tiled convolution kernel from the layer shape.
+
+    Returns tile width, tile height, number of output channels per
+    work-item, number of work-items along the channel dimension
+    and number of input channels staged in local memory at once.
+    Output channels of a work-group are in the same convolution group.
+    '''
+    width, height, depth = layer.get_output_shape()
+    last_depth = last_layer.get_output_shape()[2]
+    # tile channels of a convolution group
+    groups = layer['groups']
+    depth, last_depth = depth // groups, last_depth // groups
+    kw, kh = layer['kernel']['width'], layer['kernel']['height']
+    max_group = OpenCLGenerator.__MAX_GROUP_SIZE
+    max_local = OpenCLGenerator.__MAX_LOCAL_FLOATS
+    max_tile = OpenCLGenerator.__MAX_TILE_SIZE
+    # spatial tile, prefer divisors of the output size
+    tw = Generator._max_divisor(width, max_tile)
+    if tw < max_tile // 2 and width > max_tile:
+      tw = max_tile
+    th = Generator._max_divisor(height, min(max_tile, max_group // tw))
+    if th < max_tile // 2 and height > max_tile:
+      th = min(max_tile, max_group // tw)
+    # output channels per work-item, keep enough work-items
+    cb = 1
+    for i in range(OpenCLGenerator.__MAX_CHANNEL_BLOCK, 1, -1):
+      if depth % i == 0 and width * height * depth * groups // i >= \
+              OpenCLGenerator.__MIN_WORK_ITEMS:
+        cb = i
+        break
+    # work-items along channel dimension
+    lc = Generator._max_divisor(depth // cb, min(
+        OpenCLGenerator.__MAX_LOCAL_CHANNELS, max_group // (tw * th)))
+    # fit input tile and filter block in local memory
+    tile_in = (tw + kw - 1) * (th + kh - 1)
+    while tile_in + lc * cb * kw * kh > max_local and lc > 1:
+      lc = Generator._max_divisor(depth // cb, lc - 1)
+    while tile_in + lc * cb * kw * kh > max_local and cb > 1:
+      cb = Generator._max_divisor(depth, cb - 1)
+    ib = Generator._max_divisor(
+        last_depth, max_local // (tile_in + lc * cb * kw * kh))
+    return tw, th, cb, lc, ib
 
   def __gen_pooling(self, layer_id: int, layer: Pooling, last_layer: Layer) -> None:
     '''
@@ -215,9 +839,34 @@ class OpenCLGenerator(Generator):
     self.__code += f'#define OUTPUT_WIDTH {layer["output"]["width"]}\n'
     self.__code += f'#define OUTPUT_HEIGHT {layer["output"]["height"]}\n'
     self.__code += f'#define OUTPUT_DEPTH {layer["output"]["depth"]}\n'
-    self.__code += f'#define ACTIVATION {layer["activation"]}\n\n'
+    self.__code += f'#define ACTIVATION {layer["activation"]}\n'
+    self.__code += Generator._gen_raw_input(
+        last_layer, OpenCLGenerator.__RAW_TYPE)
+    self.__code += self.__gen_spaces(layer_id)
+    if self.__opt and not self.__fused:
+      lh, lw = self.__tuned(
+          layer_id, OpenCLGenerator.__LOCAL_PARAMS,
+          lambda: OpenCLGenerator.__pooling_tiling(layer))
+      width, height, depth = layer.get_output_shape()
+      global_size = (depth * self.__batch, height, width)
+      self.__work_sizes.append((layer_id, global_size, (1, lh, lw)))
+    self.__code += '\n'
     self.__code += f'{self.__pooling}\n'
 
+  @staticmethod
+  def __pooling_tiling(layer: Pooling) -> Tuple[int, int]:
+    '''
+    Pick work-group shape of the pooling kernel, which does not check
+    bounds, so the shape must divide the output shape.
+
+    Returns numbers of work-items along the height and the width.
+    '''
+    width, height, _ = layer.get_output_shape()
+    if width != height:
+      return 1, 1
+    size = Generator._max_divisor(width, 10)
+    return size, size
+
   def __gen_full_conn(self, layer_id: int, layer: FullConnection, last_layer: Layer) -> None:
     '''
     Generate fully connection layer.
@@ -227,29 +876,216 @@ class OpenCLGenerator(Generator):
     self.__code += f'#define LAYER_ID {layer_id}\n'
     self.__code += f'#define INPUT_SIZE {last_size}\n'
     self.__code += f'#define OUTPUT_SIZE {size}\n'
-    self.__code += f'#define ACTIVATION {layer["activation"]}\n\n'
-    self.__code += f'{self.__fullconn}\n'
+    self.__code += f'#define ACTIVATION {layer["activation"]}\n'
+    self.__code += Generator._gen_raw_input(
+        last_layer, OpenCLGenerator.__RAW_TYPE)
+    self.__code += self.__gen_spaces(layer_id)
+    if self.__opt and not self.__fused:
+      og, rs = self.__tuned(
+          layer_id, OpenCLGenerator.__FC_PARAMS,
+          lambda: OpenCLGenerator.__fc_tiling(layer, last_layer, self.__batch))
+      self.__code += f'#define OUTPUT_GROUP {og}\n'
+      vecs = -(-size // (og * 4)) * og
+      if self.__batch > 1:
+        self.__code += f'#define BATCH_GROUP {rs}\n'
+        self.__code += f'#define TILE_DEPTH {OpenCLGenerator.__TILE_DEPTH}\n'
+        global_size = (vecs, -(-self.__batch // rs) * rs, 1)
+      else:
+        self.__code += f'#define REDUCE_SIZE {rs}\n'
+        global_size = (vecs, rs, 1)
+      self.__work_sizes.append((layer_id, global_size, (og, rs, 1)))
+    self.__code += f'\n{self.__fullconn}\n'
+
+  @staticmethod
+  def __fc_tiling(layer: FullConnection, last_layer: Layer,
+                  batch: int) -> Tuple[int, int]:
+    '''
+    Pick work-group shape of the fully connection kernel.
+
+    Each work-item computes 4 outputs, returns number of work-items
+    along the output dimension, and number of work-items along the
+    input dimension (reduction, for GEMV) or batch dimension (for GEMM).
+    '''
+    vecs = -(-layer['output_size'] // 4)
+    last_size = last_layer.get_output_size()
+    max_group = OpenCLGenerator.__MAX_GROUP_SIZE
+    og = Generator._max_divisor(vecs, OpenCLGenerator.__MAX_TILE_SIZE)
+    if og < OpenCLGenerator.__MAX_TILE_SIZE // 2 and \
+            vecs > OpenCLGenerator.__MAX_TILE_SIZE:
+      og = OpenCLGenerator.__MAX_TILE_SIZE
+    if batch > 1:
+      return og, min(batch, max_group // og, OpenCLGenerator.__MAX_TILE_SIZE)
+    # power of 2 for tree reduction, at least 4 inputs per work-item
+    rs = 1
+    while rs * 2 <= min(max_group // og, OpenCLGenerator.__MAX_REDUCE_SIZE) \
+            and rs * 8 <= last_size:
+      rs *= 2
+    return og, rs
+
+  def __gen_spaces(self, layer_id: int) -> str:
+    '''
+    Generate address spaces of inputs & outputs of a layer in the fused
+    kernel, only inputs of the first layer and outputs of the last layer
+    are in global memory.
+    '''
+    if not self.__fused:
+      return ''
+    in_space = 'global' if layer_id == 1 else 'local'
+    out_space = 'global' if layer_id == self.__last_id else 'local'
+    code = f'#define INPUT_SPACE {in_space}\n'
+    code += f'#define OUTPUT_SPACE {out_space}\n'
+    return code
+
+  def __fused_config(self, network: Network) -> Tuple[int, int, int, int]:
+    '''
+    Pick configuration of the fused kernel.
+
+    Returns number of inputs per work-group, work-group size, and sizes
+    (floats) of both local buffers of activations.
+    '''
+    # outputs of layers are stored in local buffers alternately
+    sizes = [layer.get_output_size() for layer in network.layers[1:-1]]
+    local0 = max(sizes[0::2], default=0)
+    local1 = max(sizes[1::2], default=0)
+    max_local = OpenCLGenerator.__MAX_FUSED_LOCAL_FLOATS
+    if local0 + local1 > max_local:
+      raise ValueError('activations of network exceed local memory, '
+                       'can not generate fused kernel')
+    images = Generator._max_divisor(
+        self.__batch, max_local // max(local0 + local1, 1))
+    max_output = max(l.get_output_size() for l in network.layers[1:])
+    group = min(OpenCLGenerator.__MAX_GROUP_SIZE, max_output * images)
+    return images, group, max(local0 * images, 1), max(local1 * images, 1)
+
+  def __gen_network(self, network: Network, local0: int,
+                    local1: int) -> None:
+    '''
+    Generate the fused kernel running all layers.
+    '''
+    layer_desc = []
+    for i, layer in enumerate(network.layers[1:], 1):
+      layer_type = OpenCLGenerator.__LAYER_TYPE[layer.layer_type()]
+      src = 'input' if i == 1 else f'act{i % 2}'
+      dst = 'output' if i == self.__last_id else f'act{(i - 1) % 2}'
+      layer_desc.append(f'e({layer_type}, {i}, {src}, {dst})')
+    input_layer = network.layers[0]
+    input_type = OpenCLGenerator.__RAW_TYPE[input_layer['element']]
+    self.__code += f'#define FUSED_LAYERS(e) {" ".join(layer_desc)}\n'
+    self.__code += f'#define FUSED_LOCAL0 {local0}\n'
+    self.__code += f'#define FUSED_LOCAL1 {local1}\n'
+    self.__code += f'#define FUSED_INPUT_TYPE {input_type}\n'
+    self.__code += f'#define FUSED_INPUT_SIZE {input_layer.get_raw_size()}\n'
+    self.__code += f'#define FUSED_OUTPUT_SIZE {network.layers[-1].get_output_size()}\n'
+    self.__code += f'\n{self.__network}\n'
+
+  def __host_time(self, layer: Layer, last_layer: Layer) -> float:
+    '''
+    Estimate time (seconds) of running a layer on host for a batch,
+    tuned time is used if available.
+    '''
+    config = self.__tuning.get(Generator._layer_key(layer, last_layer))
+    if config is not None and 'time' in config:
+      time = config['time'] * 1e-9
+    else:
+      flops = 2 * Generator._layer_cost(layer, last_layer)
+      time = flops / OpenCLGenerator.__HOST_FLOPS
+    return time * self.__batch
+
+  def __device_time(self, layer: Layer, last_layer: Layer) -> float:
+    '''
+    Estimate time (seconds) of running a layer on device for a batch.
+    '''
+    flops = 2 * Generator._layer_cost(layer, last_layer) * self.__batch
+    return OpenCLGenerator.__LAUNCH_TIME + \
+        flops / OpenCLGenerator.__DEVICE_FLOPS
+
+  def __transfer_time(self, size: int) -> float:
+    '''
+    Estimate time (seconds) of transferring a batch of data between host
+    and device, `size` is the number of bytes per input.
+    '''
+    return OpenCLGenerator.__TRANSFER_TIME + \
+        size * self.__batch / OpenCLGenerator.__TRANSFER_BANDWIDTH
+
+  def __place(self, network: Network) -> Set[int]:
+    '''
+    Place layers of a heterogeneous network on host or device, minimizing
+    the estimated total time including transfers at boundaries between
+    host and device. Inputs are read and outputs are written on host.
+
+    Returns IDs of layers placed on host.
+    '''
+    if self.__host_layers is not None:
+      return set(self.__host_layers)
+    input_layer = network.layers[0]
+    size = input_layer.get_raw_size() * \
+        OpenCLGenerator.__RAW_BYTES[input_layer['element']]
+    # minimum time and placement of layers so far, with outputs of the
+    # last layer on host (`True`) or on device (`False`)
+    best = {True: (0.0, []), False: (self.__transfer_time(size), [])}
+    for i, layer in enumerate(network.layers[1:], 1):
+      last_layer = network.layers[i - 1]
+      size = last_layer.get_output_size() * 4
+      run = {True: self.__host_time(layer, last_layer),
+             False: self.__device_time(layer, last_layer)}
+      new_best = {}
+      for host in (True, False):
+        # inputs are transferred if the last layer runs elsewhere
+        time, placement = min(
+            (best[host][0], best[host][1]),
+            (best[not host][0] + self.__transfer_time(size),
+             best[not host][1]),
+            key=lambda x: x[0])
+        new_best[host] = (time + run[host], placement + [host])
+      best = new_best
+    size = network.layers[-1].get_output_size() * 4
+    best[False] = (best[False][0] + self.__transfer_time(size), best[False][1])
+    _, placement = min(best.values(), key=lambda x: x[0])
+    return {i for i, host in enumerate(placement, 1) if host}
 
   def generate(self, network: Network) -> None:
     self.__code = '#define GENERATED\n\n'
-    if self.__opt:
+    self.__work_sizes = []
+    self.__last_id = len(network.layers) - 1
+    host_layers = self.__place(network) if self.__hetero else set()
+    if host_layers:
+      self.__code += '#define HETERO\n'
+      if 1 in host_layers:
+        self.__code += '#define HOST_INPUT\n'
+    options = []
+    if self.__opt and not self.__fused:
       self.__code += '#define OPT\n'
-      self.__code += 'const char *kOpenCLOptions = "-DOPT";\n'
-    else:
-      self.__code += 'const char *kOpenCLOptions = "";\n'
+      options.append('-DOPT')
+    if self.__fused:
+      images, group, local0, local1 = self.__fused_config(network)
+      self.__code += '#define FUSED\n'
+      options.append('-DFUSED')
+      options.append(f'-DFUSED_IMAGES={images}')
+    if self.__batch > 1:
+      options.append(f'-DBATCH_SIZE={self.__batch}')
+    self.__code += f'const char *kOpenCLOptions = "{" ".join(options)}";\n'
     self.__code += 'const char *kOpenCLProgram = R"(\n'
     self.__code += f'{self.__define}\n'
+    self.__pick_configs(network)
     # generate all layers
-    layer_gen = {
-        'input': self.__gen_input,
-        'convolution': self.__gen_conv,
-        'pooling': self.__gen_pooling,
-        'full_connection': self.__gen_full_conn,
-    }
     for i, layer in enumerate(network.layers):
-      layer_gen[layer.layer_type()](
-          i, layer, network.layers[i - 1] if i - 1 >= 0 else None)
+      if i in host_layers:
+        continue
+      self.__gen_layer(i, layer, network.layers[i - 1] if i - 1 >= 0 else None)
+    if self.__fused:
+      self.__gen_network(network, local0, local1)
     self.__code += ')";\n\n'
+    # generate layers placed on host as C++ functions
+    host_desc = []
+    if host_layers:
+      host_gen = CppGenerator(tuning=self.__tuning)
+      host_gen.generate_layers(network, sorted(host_layers))
+      host_code = io.StringIO()
+      host_gen.dump(host_code)
+      self.__code += host_code.getvalue()
+      for i in sorted(host_layers):
+        layer_type = OpenCLGenerator.__LAYER_TYPE[network.layers[i].layer_type()]
+        host_desc.append(f'e({layer_type}, {i})')
     # generate the architecture of network
     layer_desc = []
     for i, layer in enumerate(network.layers):
@@ -258,8 +1094,181 @@ class OpenCLGenerator(Generator):
         w, h, d = layer.get_output_shape()
         layer_desc.append(f'e({layer_type}, {i}, {w}, {h}, {d})')
     self.__code += f'#define NETWORK_LAYERS(e) {" ".join(layer_desc)}\n'
-    self.__code += f'#define OUTPUT_SIZE {network.layers[-1].get_output_size()}\n\n'
+    work_sizes = []
+    for i, g, l in self.__work_sizes:
+      work_sizes.append(f'e({i}, {", ".join(map(str, g + l))})')
+    self.__code += f'#define NETWORK_WORK_SIZES(e) {" ".join(work_sizes)}\n'
+    self.__code += f'#define HOST_LAYERS(e) {" ".join(host_desc)}\n'
+    input_type = OpenCLGenerator.__RAW_HOST_TYPE[network.layers[0]['element']]
+    self.__code += f'#define INPUT_TYPE {input_type}\n'
+    self.__code += f'#define INPUT_SIZE {network.layers[0].get_raw_size()}\n'
+    self.__code += f'#define OUTPUT_SIZE {network.layers[-1].get_output_size()}\n'
+    self.__code += f'#define BATCH_SIZE {self.__batch}\n'
+    if self.__fused:
+      self.__code += f'#define FUSED_IMAGES {images}\n'
+      self.__code += f'#define FUSED_GROUP_SIZE {group}\n'
+    self.__code += '\n'
     self.__code += f'{self.__main}\n'
 
+  def __pick_configs(self, network: Network) -> None:
+    '''
+    Pick configurations of tiled kernels tuned on the device for all
+    layers of the specific network.
+    '''
+    self.__configs = {}
+    if not self.__opt or self.__fused:
+      return
+    for i, layer in enumerate(network.layers[1:], 1):
+      key = OpenCLGenerator._device_layer_key(
+          layer, network.layers[i - 1], self.__batch)
+      if key in self.__device_tuning:
+        self.__configs[i] = self.__device_tuning[key]
+
+  def generate_bench(self, network: Network,
+                     variants: List[Tuple[int, Dict[str, Any]]],
+                     repeats: int) -> None:
+    '''
+    Generate a benchmark of tiled kernel variants, `variants` contains
+    indices of layers and their configurations. The benchmark prints the
+    identity of the device, and the median time (in nanoseconds) of
+    `repeats` runs of each variant on a batch.
+    '''
+    self.__code = '#define GENERATED\n\n'
+    self.__work_sizes = []
+    self.__configs = {}
+    options = ['-DOPT']
+    if self.__batch > 1:
+      options.append(f'-DBATCH_SIZE={self.__batch}')
+    self.__code += f'const char *kOpenCLOptions = "{" ".join(options)}";\n'
+    self.__code += 'const char *kOpenCLProgram = R"(\n'
+    self.__code += f'{self.__define}\n'
+    for k, (i, config) in enumerate(variants):
+      # variant IDs are pp-numbers like `1_0`
+      variant_id = f'{i}_{k}'
+      self.__configs[variant_id] = config
+      self.__gen_layer(variant_id, network.layers[i], network.layers[i - 1])
+    self.__code += ')";\n\n'
+    work_sizes = {i: g + l for i, g, l in self.__work_sizes}
+    bench_desc = []
+    for variant_id, (i, _) in zip(self.__configs, variants):
+      layer, last_layer = network.layers[i], network.layers[i - 1]
+      layer_type = OpenCLGenerator.__LAYER_TYPE[layer.layer_type()]
+      in_size = last_layer.get_output_size()
+      if isinstance(last_layer, Input):
+        in_size = max(in_size, last_layer.get_raw_size())
+      weight_size, bias_size = Generator._param_sizes(layer, last_layer)
+      sizes = ', '.join(map(str, work_sizes[variant_id]))
+      bench_desc.append(f'e({layer_type}, {variant_id}, {in_size}, '
+                        f'{layer.get_output_size()}, {weight_size}, '
+                        f'{bias_size}, {sizes})')
+    self.__code += f'#define BENCH_VARIANTS(e) {" ".join(bench_desc)}\n'
+    self.__code += f'#define BENCH_REPEATS {repeats}\n'
+    self.__code += f'#define BATCH_SIZE {self.__batch}\n\n'
+    self.__code += f'{self.__bench}\n'
+
+  def __gen_layer(self, layer_id: Any, layer: Layer,
+                  last_layer: Optional[Layer]) -> None:
+    '''
+    Generate a layer, `layer_id` is the ID of layer in generated code.
+    '''
+    layer_gen = {
+        'input': self.__gen_input,
+        'convolution': self.__gen_conv,
+        'pooling': self.__gen_pooling,
+        'full_connection': self.__gen_full_conn,
+    }
+    layer_gen[layer.layer_type()](layer_id, layer, last_layer)
+
+  @staticmethod
+  def _device_layer_key(layer: Layer, last_layer: Layer, batch: int) -> str:
+    '''
+    Get key of a layer in tuning databases of OpenCL devices, tiled
+    kernels also depend on the batch size.
+    '''
+    return f'{Generator._layer_key(layer, last_layer)} b{batch}'
+
+  @staticmethod
+  def _tiling_candidates(layer: Layer, last_layer: Layer,
+                         batch: int) -> List[Dict[str, Any]]:
+    '''
+    Get candidate configurations of the tiled kernel of the specific
+    layer, including the configuration picked from the layer shape.
+    '''
+    max_group = OpenCLGenerator.__MAX_GROUP_SIZE
+    max_tile = OpenCLGenerator.__MAX_TILE_SIZE
+    # powers of 2 up to the tile limitation, and the whole `n`
+    def sizes(n: int) -> Set[int]:
+      return {min(1 << i, n) for i in range(max_tile.bit_length())}
+    candidates = []
+    if isinstance(layer, Convolution) and \
+            Generator._is_depthwise_3x3(layer, last_layer):
+      width, height, _ = layer.get_output_shape()
+      default = OpenCLGenerator.__depthwise_tiling(layer)
+      candidates.append(default)
+      for lh in sizes(height) | {default[0]}:
+        for lw in sizes(-(-width // 4)) | {default[1]}:
+          if lh * lw <= max_group:
+            candidates.append((lh, lw))
+      params = OpenCLGenerator.__LOCAL_PARAMS
+    elif isinstance(layer, Convolution):
+      width, height, depth = layer.get_output_shape()
+      last_depth = last_layer.get_output_shape()[2]
+      depth, last_depth = depth // layer['groups'], \
+          last_depth // layer['groups']
+      kernel = layer['kernel']['width'] * layer['kernel']['height']
+      max_local = OpenCLGenerator.__MAX_LOCAL_FLOATS
+      default = OpenCLGenerator.__conv_tiling(layer, last_layer)
+      tws = {min(s, width) for s in (4, 8, max_tile)} | {default[0]}
+      ths = {min(s, height) for s in (4, 8, max_tile)} | {default[1]}
+      cbs = {i for i in (1, 2, 4, 8) if depth % i == 0} | {default[2]}
+      candidates.append(default)
+      for tw in tws:
+        for th in ths:
+          if tw * th > max_group:
+            continue
+          tile_in = (tw + layer['kernel']['width'] - 1) * \
+              (th + layer['kernel']['height'] - 1)
+          limit = min(OpenCLGenerator.__MAX_LOCAL_CHANNELS,
+                      max_group // (tw * th))
+          for cb in cbs:
+            for lc in {Generator._max_divisor(depth // cb, limit),
+                       Generator._max_divisor(depth // cb, limit // 4)}:
+              # fit input tile and filter block in local memory
+              if tile_in + lc * cb * kernel > max_local:
+                continue
+              ib = Generator._max_divisor(
+                  last_depth, max_local // (tile_in + lc * cb * kernel))
+              candidates.append((tw, th, cb, lc, ib))
+      params = OpenCLGenerator.__CONV_PARAMS
+    elif isinstance(layer, Pooling):
+      # the pooling kernel does not check bounds
+      width, height, _ = layer.get_output_shape()
+      candidates.append(OpenCLGenerator.__pooling_tiling(layer))
+      lhs = [i for i in range(1, max_tile + 1) if height % i == 0]
+      lws = [i for i in range(1, max_tile + 1) if width % i == 0]
+      for lh in lhs:
+        for lw in lws:
+          if lh * lw <= max_group:
+            candidates.append((lh, lw))
+      params = OpenCLGenerator.__LOCAL_PARAMS
+    elif isinstance(layer, FullConnection):
+      vecs = -(-layer['output_size'] // 4)
+      default = OpenCLGenerator.__fc_tiling(layer, last_layer, batch)
+      candidates.append(default)
+      for og in sizes(vecs) | {default[0]}:
+        if batch > 1:
+          inners = sizes(batch)
+        else:
+          # power of 2 for tree reduction
+          max_reduce = OpenCLGenerator.__MAX_REDUCE_SIZE
+          inners = {1 << i for i in range(max_reduce.bit_length())}
+        for inner in inners:
+          if og * inner <= max_group:
+            candidates.append((og, inner))
+      params = OpenCLGenerator.__FC_PARAMS
+    else:
+      return []
+    return [dict(zip(params, c)) for c in dict.fromkeys(candidates)]
+
   def dump(self, f: TextIO) -> None:
     f.write(self.__code)
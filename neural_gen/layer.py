@@ -54,6 +54,12 @@ class Input(Layer):
     self.__width: int = d['width']
     self.__height: int = d['height']
     self.__depth: int = d['depth']
+    # raw input, converted by `raw * scale + offset`, and padded with
+    # raw zeros to the shape of the layer
+    self.__element: str = d.get('element', 'float')
+    self.__scale: float = d.get('scale', 1.0)
+    self.__offset: float = d.get('offset', 0.0)
+    self.__padding: Dict[str, int] = d.get('padding', {'x': 0, 'y': 0})
     return self
 
   def to_dict(self) -> Dict[str, Any]:
@@ -62,6 +68,10 @@ class Input(Layer):
         'width': self.__width,
         'height': self.__height,
         'depth': self.__depth,
+        'element': self.__element,
+        'scale': self.__scale,
+        'offset': self.__offset,
+        'padding': self.__padding,
     }
 
   def get_output_shape(self) -> Tuple[int, int, int]:
@@ -70,6 +80,28 @@ class Input(Layer):
   def get_output_size(self) -> int:
     return self.__width * self.__height * self.__depth
 
+  def is_raw(self) -> bool:
+    '''
+    Check if the input needs to be converted by the first layer.
+    '''
+    return self.__element != 'float' or self.__scale != 1 or \
+        self.__offset != 0 or self.__padding['x'] != 0 or \
+        self.__padding['y'] != 0
+
+  def get_raw_shape(self) -> Tuple[int, int, int]:
+    '''
+    Get shape (width, height, depth) of the raw input.
+    '''
+    return (self.__width - 2 * self.__padding['x'],
+            self.__height - 2 * self.__padding['y'], self.__depth)
+
+  def get_raw_size(self) -> int:
+    '''
+    Get size of the raw input.
+    '''
+    width, height, depth = self.get_raw_shape()
+    return width * height * depth
+
 
 class Convolution(Layer):
   '''
@@ -86,6 +118,12 @@ class Convolution(Layer):
     self.__kernel: Dict[str, int] = d['kernel']
     self.__output: Dict[str, int] = d['output']
     self.__activation: str = d['activation']
+    # grouped convolution, input & output channels are split into
+    # `groups` groups, and output channels only convolve input channels
+    # of their groups (depthwise if each group has one input channel)
+    self.__groups: int = d.get('groups', 1)
+    if self.__groups < 1 or self.__output['depth'] % self.__groups:
+      raise ValueError('output depth must be a multiple of groups')
     return self
 
   def to_dict(self) -> Dict[str, Any]:
@@ -96,6 +134,7 @@ class Convolution(Layer):
         'kernel': self.__kernel,
         'output': self.__output,
         'activation': self.__activation,
+        'groups': self.__groups,
     }
 
   def get_output_shape(self) -> Tuple[int, int, int]:
@@ -0,0 +1,42 @@
+from typing import List, Tuple
+from struct import unpack, calcsize
+
+
+'''
+Magic number of model file.
+'''
+MAGIC_NUMBER = 0x1909eca1
+
+
+'''
+Weight & bias of a layer.
+'''
+LayerData = Tuple[Tuple[float, ...], Tuple[float, ...]]
+
+
+def __read(f, fmt: str) -> Tuple:
+  '''
+  Read and unpack data of the specific format from file.
+  '''
+  size = calcsize(fmt)
+  data = f.read(size)
+  if len(data) != size:
+    raise ValueError('invalid model file, unexpected end of file')
+  return unpack(fmt, data)
+
+
+def read_model(file: str) -> List[LayerData]:
+  '''
+  Read weights & biases of all layers from the specific model file.
+  '''
+  with open(file, 'rb') as f:
+    magic, layer_num = __read(f, '<II')
+    if magic != MAGIC_NUMBER:
+      raise ValueError('invalid model file, magic number mismatch')
+    model = []
+    for _ in range(layer_num):
+      weight_size, bias_size = __read(f, '<II')
+      weight = __read(f, f'<{weight_size}f')
+      bias = __read(f, f'<{bias_size}f')
+      model.append((weight, bias))
+    return model
@@ -0,0 +1,66 @@
+#ifndef GENERATED
+#include "define.h"
+#define BENCH_VARIANTS(e) e(CONV_3D, 1_0, 1024, 4704, 150, 6)
+#define BENCH_REPEATS 50
+#endif  // GENERATED
+
+// expand declarations of all variants
+#define DECL_EXPANDER(type, id, in_size, out_size, weight_size, bias_size) \
+  DECL_LAYER(type, id);
+BENCH_VARIANTS(DECL_EXPANDER);
+#undef DECL_EXPANDER
+
+namespace {
+
+// pointer to float array
+using FloatArr = std::unique_ptr<float[]>;
+
+// allocate float array filled with the specific value
+FloatArr NewArray(size_t size, float value) {
+  auto arr = std::make_unique<float[]>(size);
+  std::fill(arr.get(), arr.get() + size, value);
+  return arr;
+}
+
+// measure the median time (in nanoseconds) of running a layer variant
+double Measure(void (*run)(const float *, float *, const float *,
+                           const float *),
+               size_t in_size, size_t out_size, size_t weight_size,
+               size_t bias_size) {
+  auto in = NewArray(in_size, 0.5f);
+  auto out = NewArray(out_size, 0.0f);
+  auto weight = NewArray(weight_size, 0.01f);
+  auto bias = NewArray(bias_size, 0.1f);
+  std::vector<double> times;
+  // the first run warms up caches and OpenMP threads
+  for (size_t i = 0; i <= BENCH_REPEATS; ++i) {
+    auto begin = std::chrono::steady_clock::now();
+    run(in.get(), out.get(), weight.get(), bias.get());
+    auto end = std::chrono::steady_clock::now();
+    if (!i) continue;
+    times.push_back(
+        std::chrono::duration<double, std::nano>(end - begin).count());
+  }
+  auto mid = times.begin() + times.size() / 2;
+  std::nth_element(times.begin(), mid, times.end());
+  return *mid;
+}
+
+}  // namespace
+
+int main() {
+#define BENCH_EXPANDER(type, id, in_size, out_size, weight_size,      \
+                       bias_size)                                     \
+  std::cout << #id << ' '                                             \
+            << Measure(type(id), in_size, out_size, weight_size,      \
+                       bias_size)                                     \
+            << std::endl;
+
+  BENCH_VARIANTS(BENCH_EXPANDER);
+  return 0;
+
+#undef BENCH_EXPANDER
+}
+
+#undef BENCH_VARIANTS
+#undef BENCH_REPEATS
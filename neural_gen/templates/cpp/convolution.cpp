@@ -14,23 +14,145 @@
 #define OUTPUT_HEIGHT 28
 #define OUTPUT_DEPTH 6
 #define ACTIVATION tanh
+#define PARALLEL_THREADS 4
 #endif  // GENERATED
 
+// grouped convolution, output channels only convolve input channels of
+// their groups
+#ifndef GROUPS
+#define GROUPS 1
+#endif
+#define GROUP_INPUT_DEPTH (INPUT_DEPTH / GROUPS)
+#define GROUP_OUTPUT_DEPTH (OUTPUT_DEPTH / GROUPS)
+
+// the first input channel of the group of an output channel
+#if GROUPS == 1
+#define GROUP_FIRST_INPUT(channel) 0
+#else
+#define GROUP_FIRST_INPUT(channel) \
+  ((channel) / GROUP_OUTPUT_DEPTH * GROUP_INPUT_DEPTH)
+#endif
+
 DECL_LAYER(CONV_3D, LAYER_ID) {
-#ifdef _OPENMP
-#if defined(SIMD)
+#ifdef RAW_INPUT
+  const auto raw = reinterpret_cast<const RAW_INPUT_TYPE *>(in);
+#endif  // RAW_INPUT
+#if defined(_OPENMP) && PARALLEL_THREADS > 1
+#if defined(PARALLEL_OUTER)
+#pragma omp parallel for num_threads(LAYER_THREADS)
+#elif defined(SPARSE_WEIGHT) || defined(DEPTHWISE_3X3)
+#pragma omp parallel for collapse(2) num_threads(LAYER_THREADS)
+#elif defined(SIMD) && !defined(RAW_INPUT)
 #if SIMD_ALIGN(OUTPUT_WIDTH) != 0 && SIMD_REMAIN(OUTPUT_WIDTH) != 0
-#pragma omp parallel for collapse(2)
+#pragma omp parallel for collapse(2) num_threads(LAYER_THREADS)
 #else
-#pragma omp parallel for collapse(3)
+#pragma omp parallel for collapse(3) num_threads(LAYER_THREADS)
 #endif
 #else
-#pragma omp parallel for collapse(3)
+#pragma omp parallel for collapse(3) num_threads(LAYER_THREADS)
 #endif
-#endif  // _OPENMP
+#endif  // _OPENMP && PARALLEL_THREADS > 1
   for (size_t channel = 0; channel < OUTPUT_DEPTH; ++channel) {
     for (size_t y = 0; y < OUTPUT_HEIGHT; ++y) {
+#if defined(RAW_INPUT)
+      for (size_t x = 0; x < OUTPUT_WIDTH; ++x) {
+        // current neuron
+        size_t index =
+            (channel * OUTPUT_HEIGHT * OUTPUT_WIDTH) + y * OUTPUT_WIDTH + x;
+        float cur = 0.0;
+        // perform convolution, read raw input directly
+#ifdef LAYER_UNROLL
+        UNROLL_LOOP(LAYER_UNROLL)
+#endif  // LAYER_UNROLL
+        for (size_t inc = 0; inc < GROUP_INPUT_DEPTH; ++inc) {
+          size_t addr1 = GetIndex(0, 0, GROUP_INPUT_DEPTH * channel + inc,
+                                  KERNEL_WIDTH, KERNEL_HEIGHT,
+                                  OUTPUT_DEPTH * GROUP_INPUT_DEPTH);
+          size_t in_channel = GROUP_FIRST_INPUT(channel) + inc;
+          float sum = 0.0;
+          const float *ppw = weight + addr1;
+          for (size_t wy = 0; wy < KERNEL_HEIGHT; wy++) {
+            for (size_t wx = 0; wx < KERNEL_WIDTH; wx++) {
+              sum += *ppw++ *
+                     READ_RAW_INPUT(raw, x + wx, y + wy, in_channel);
+            }
+          }
+          cur += sum;
+        }
+        // add bias and perform activation
+        out[index] = ACT_FUNC(ACTIVATION)(cur + bias[channel]);
+      }
+#elif defined(SPARSE_WEIGHT)
+      // nonzero weights of output channels in CSR format,
+      // column indices are offsets of the corresponding inputs
+      const auto ptr = EMBEDDED_SPARSE_PTR(LAYER_ID);
+      const auto idx = EMBEDDED_SPARSE_IDX(LAYER_ID);
+      const float *pi = in + y * INPUT_WIDTH;
+      float *po = out + (channel * OUTPUT_HEIGHT + y) * OUTPUT_WIDTH;
+      size_t x = 0;
 #ifdef SIMD
+      for (; x < SIMD_ALIGN(OUTPUT_WIDTH); x += SIMD_VEC_LEN) {
+        VecN mm_cur = SIMD_MM(set1_ps)(bias[channel]);
+        for (auto k = ptr[channel]; k < ptr[channel + 1]; ++k) {
+          VecN mm_weight = SIMD_MM(set1_ps)(weight[k]);
+          VecN mm_in = SIMD_MM(loadu_ps)(pi + idx[k] + x);
+          mm_cur =
+              SIMD_MM(add_ps)(mm_cur, SIMD_MM(mul_ps)(mm_weight, mm_in));
+        }
+        SIMD_MM(storeu_ps)(po + x, mm_cur);
+      }
+#endif  // SIMD
+      for (; x < OUTPUT_WIDTH; ++x) {
+        float cur = bias[channel];
+        for (auto k = ptr[channel]; k < ptr[channel + 1]; ++k) {
+          cur += weight[k] * pi[idx[k] + x];
+        }
+        po[x] = cur;
+      }
+      // perform activation
+      for (x = 0; x < OUTPUT_WIDTH; ++x) {
+        po[x] = ACT_FUNC(ACTIVATION)(po[x]);
+      }
+#elif defined(DEPTHWISE_3X3)
+      // each output channel convolves its own input channel, weights of
+      // the channel stay in registers
+      const float *pw = weight + channel * 9;
+      const float *pi = in + (channel * INPUT_HEIGHT + y) * INPUT_WIDTH;
+      float *po = out + (channel * OUTPUT_HEIGHT + y) * OUTPUT_WIDTH;
+      size_t x = 0;
+#ifdef SIMD
+      VecN mm_weight[9];
+      for (size_t k = 0; k < 9; ++k) {
+        mm_weight[k] = SIMD_MM(set1_ps)(pw[k]);
+      }
+      VecN mm_bias = SIMD_MM(set1_ps)(bias[channel]);
+      for (; x < SIMD_ALIGN(OUTPUT_WIDTH); x += SIMD_VEC_LEN) {
+        VecN mm_cur = SIMD_MM(setzero_ps)();
+        for (size_t wy = 0; wy < 3; wy++) {
+          const float *ppi = pi + wy * INPUT_WIDTH + x;
+          for (size_t wx = 0; wx < 3; wx++) {
+            VecN mm_in = SIMD_MM(loadu_ps)(ppi + wx);
+            mm_cur = SIMD_MM(add_ps)(
+                mm_cur, SIMD_MM(mul_ps)(mm_weight[wy * 3 + wx], mm_in));
+          }
+        }
+        SIMD_MM(storeu_ps)(po + x, SIMD_MM(add_ps)(mm_cur, mm_bias));
+      }
+#endif  // SIMD
+      for (; x < OUTPUT_WIDTH; ++x) {
+        float cur = 0.0;
+        for (size_t wy = 0; wy < 3; wy++) {
+          for (size_t wx = 0; wx < 3; wx++) {
+            cur += pw[wy * 3 + wx] * pi[wy * INPUT_WIDTH + x + wx];
+          }
+        }
+        po[x] = cur + bias[channel];
+      }
+      // perform activation
+      for (x = 0; x < OUTPUT_WIDTH; ++x) {
+        po[x] = ACT_FUNC(ACTIVATION)(po[x]);
+      }
+#elif defined(SIMD)
 #if SIMD_ALIGN(OUTPUT_WIDTH) != 0
       for (size_t x = 0; x < SIMD_ALIGN(OUTPUT_WIDTH); x += SIMD_VEC_LEN) {
         // current neuron
@@ -39,12 +161,16 @@ DECL_LAYER(CONV_3D, LAYER_ID) {
         VecN mm_bias = SIMD_MM(set1_ps)(bias[channel]);
         VecN mm_cur = SIMD_MM(setzero_ps)();
         // perform convolution
-        for (size_t inc = 0; inc < INPUT_DEPTH; ++inc) {
-          size_t addr1 =
-              GetIndex(0, 0, INPUT_DEPTH * channel + inc, KERNEL_WIDTH,
-                       KERNEL_HEIGHT, OUTPUT_DEPTH * INPUT_DEPTH);
+#ifdef LAYER_UNROLL
+        UNROLL_LOOP(LAYER_UNROLL)
+#endif  // LAYER_UNROLL
+        for (size_t inc = 0; inc < GROUP_INPUT_DEPTH; ++inc) {
+          size_t addr1 = GetIndex(0, 0, GROUP_INPUT_DEPTH * channel + inc,
+                                  KERNEL_WIDTH, KERNEL_HEIGHT,
+                                  OUTPUT_DEPTH * GROUP_INPUT_DEPTH);
           size_t addr2 =
-              GetIndex(0, 0, inc, INPUT_WIDTH, INPUT_HEIGHT, INPUT_DEPTH);
+              GetIndex(0, 0, GROUP_FIRST_INPUT(channel) + inc, INPUT_WIDTH,
+                       INPUT_HEIGHT, INPUT_DEPTH);
           VecN mm_sum = SIMD_MM(setzero_ps)();
           // kernel
           const float *pw = weight + addr1;
@@ -64,14 +190,9 @@ DECL_LAYER(CONV_3D, LAYER_ID) {
         }
         // add bias and perform activation
         SIMD_MM(storeu_ps)(out + index, SIMD_MM(add_ps)(mm_cur, mm_bias));
-        out[index + 0] = ACT_FUNC(ACTIVATION)(out[index + 0]);
-        out[index + 1] = ACT_FUNC(ACTIVATION)(out[index + 1]);
-        out[index + 2] = ACT_FUNC(ACTIVATION)(out[index + 2]);
-        out[index + 3] = ACT_FUNC(ACTIVATION)(out[index + 3]);
-        out[index + 4] = ACT_FUNC(ACTIVATION)(out[index + 4]);
-        out[index + 5] = ACT_FUNC(ACTIVATION)(out[index + 5]);
-        out[index + 6] = ACT_FUNC(ACTIVATION)(out[index + 6]);
-        out[index + 7] = ACT_FUNC(ACTIVATION)(out[index + 7]);
+        for (size_t i = 0; i < SIMD_VEC_LEN; ++i) {
+          out[index + i] = ACT_FUNC(ACTIVATION)(out[index + i]);
+        }
       }
 #endif
 #if SIMD_REMAIN(OUTPUT_WIDTH) != 0
@@ -81,12 +202,16 @@ DECL_LAYER(CONV_3D, LAYER_ID) {
             (channel * OUTPUT_HEIGHT * OUTPUT_WIDTH) + y * OUTPUT_WIDTH + x;
         float cur = 0.0;
         // perform convolution
-        for (size_t inc = 0; inc < INPUT_DEPTH; ++inc) {
-          size_t addr1 =
-              GetIndex(0, 0, INPUT_DEPTH * channel + inc, KERNEL_WIDTH,
-                       KERNEL_HEIGHT, OUTPUT_DEPTH * INPUT_DEPTH);
+#ifdef LAYER_UNROLL
+        UNROLL_LOOP(LAYER_UNROLL)
+#endif  // LAYER_UNROLL
+        for (size_t inc = 0; inc < GROUP_INPUT_DEPTH; ++inc) {
+          size_t addr1 = GetIndex(0, 0, GROUP_INPUT_DEPTH * channel + inc,
+                                  KERNEL_WIDTH, KERNEL_HEIGHT,
+                                  OUTPUT_DEPTH * GROUP_INPUT_DEPTH);
           size_t addr2 =
-              GetIndex(0, 0, inc, INPUT_WIDTH, INPUT_HEIGHT, INPUT_DEPTH);
+              GetIndex(0, 0, GROUP_FIRST_INPUT(channel) + inc, INPUT_WIDTH,
+                       INPUT_HEIGHT, INPUT_DEPTH);
           float sum = 0.0;
           // kernel
           const float *pw = weight + addr1;
@@ -112,12 +237,16 @@ DECL_LAYER(CONV_3D, LAYER_ID) {
             (channel * OUTPUT_HEIGHT * OUTPUT_WIDTH) + y * OUTPUT_WIDTH + x;
         float cur = 0.0;
         // perform convolution
-        for (size_t inc = 0; inc < INPUT_DEPTH; ++inc) {
-          size_t addr1 =
-              GetIndex(0, 0, INPUT_DEPTH * channel + inc, KERNEL_WIDTH,
-                       KERNEL_HEIGHT, OUTPUT_DEPTH * INPUT_DEPTH);
+#ifdef LAYER_UNROLL
+        UNROLL_LOOP(LAYER_UNROLL)
+#endif  // LAYER_UNROLL
+        for (size_t inc = 0; inc < GROUP_INPUT_DEPTH; ++inc) {
+          size_t addr1 = GetIndex(0, 0, GROUP_INPUT_DEPTH * channel + inc,
+                                  KERNEL_WIDTH, KERNEL_HEIGHT,
+                                  OUTPUT_DEPTH * GROUP_INPUT_DEPTH);
           size_t addr2 =
-              GetIndex(0, 0, inc, INPUT_WIDTH, INPUT_HEIGHT, INPUT_DEPTH);
+              GetIndex(0, 0, GROUP_FIRST_INPUT(channel) + inc, INPUT_WIDTH,
+                       INPUT_HEIGHT, INPUT_DEPTH);
           float sum = 0.0;
           // kernel
           const float *pw = weight + addr1;
@@ -152,3 +281,21 @@ DECL_LAYER(CONV_3D, LAYER_ID) {
 #undef OUTPUT_HEIGHT
 #undef OUTPUT_DEPTH
 #undef ACTIVATION
+#undef RAW_INPUT
+#undef RAW_INPUT_TYPE
+#undef RAW_WIDTH
+#undef RAW_HEIGHT
+#undef RAW_DEPTH
+#undef INPUT_PAD_X
+#undef INPUT_PAD_Y
+#undef INPUT_SCALE
+#undef INPUT_OFFSET
+#undef SPARSE_WEIGHT
+#undef PARALLEL_THREADS
+#undef PARALLEL_OUTER
+#undef LAYER_UNROLL
+#undef GROUPS
+#undef GROUP_INPUT_DEPTH
+#undef GROUP_OUTPUT_DEPTH
+#undef GROUP_FIRST_INPUT
+#undef DEPTHWISE_3X3
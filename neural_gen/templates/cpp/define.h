@@ -1,25 +1,74 @@
 #ifndef NEURALGEN_DEFINE_H_
 #define NEURALGEN_DEFINE_H_
 
-#include <algorithm>    // max pooling
-#include <cassert>      // GetIndex
-#include <cmath>        // ActFuncs
-#include <cstddef>      // size_t
-#include <cstdint>      // module file struct
-#include <cstring>      // main
-#include <fstream>      // main
-#include <iostream>     // main
-#include <memory>       // main
-#include <stdexcept>    // main
-#include <string>       // main
-#include <string_view>  // main
-#include <utility>      // main
-#include <vector>       // main
+#include <algorithm>      // max pooling
+#include <atomic>         // pipeline
+#include <cassert>        // GetIndex
+#include <cctype>         // main
+#include <chrono>         // batcher, benchmark
+#include <cmath>          // ActFuncs
+#include <cstddef>        // size_t
+#include <cstdint>        // module file struct
+#include <cstring>        // main
+#include <fstream>        // main
+#include <iostream>       // main
+#include <iterator>       // result cache
+#include <limits>         // pipeline
+#include <list>           // result cache
+#include <map>            // NUMA
+#include <memory>         // main
+#include <mutex>          // NUMA
+#include <numeric>        // main
+#include <stdexcept>      // main
+#include <string>         // main
+#include <string_view>    // main
+#include <thread>         // pipeline
+#include <unordered_map>  // result cache
+#include <utility>        // main
+#include <vector>         // main
+
+#include <fcntl.h>     // result file
+#include <sys/mman.h>  // result file
+#include <unistd.h>    // result file
+
+#ifdef __linux__
+#include <pthread.h>  // pipeline
+#include <sched.h>    // pipeline
+#endif  // __linux__
 
 #ifdef _OPENMP
 #include <omp.h>
+
+// number of OpenMP threads of a layer, the number estimated by generator
+// (`PARALLEL_THREADS`) capped by the current limit
+#define LAYER_THREADS \
+  std::min<int>(PARALLEL_THREADS, omp_get_max_threads())
 #endif  // _OPENMP
 
+#ifdef PERF_COUNTERS
+#ifdef NGEN_LIBRARY
+#error PERF_COUNTERS is not supported by libraries
+#endif  // NGEN_LIBRARY
+#include <array>    // performance counters
+#include <cerrno>   // performance counters
+#include <iomanip>  // performance counters
+
+#ifdef __linux__
+#include <linux/perf_event.h>  // performance counters
+#include <sys/syscall.h>       // performance counters
+#endif  // __linux__
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>  // performance counters
+#endif  // __x86_64__ || __i386__
+#endif  // PERF_COUNTERS
+
+#ifdef NGEN_LIBRARY
+#include <condition_variable>  // batcher
+#include <exception>           // batcher
+
+#include "ngen.h"
+#endif  // NGEN_LIBRARY
+
 #if defined(__AVX__) || defined(__AVX2__)
 #include <immintrin.h>
 
@@ -60,13 +109,51 @@ using VecN = __m512;
 #define CONCAT_IMPL(x, y) x##y
 #define CONCAT(x, y) CONCAT_IMPL(x, y)
 
+// unroll the following loop by the specific factor
+#define PRAGMA(x) _Pragma(#x)
+#define UNROLL_LOOP(n) PRAGMA(GCC unroll n)
+
 #define ACT_FUNC(id) CONCAT(ActFunc_, id)
 #define CONV_3D(id) CONCAT(Conv3D_, id)
 #define POOLING(id) CONCAT(Pooling_, id)
 #define FULL_CONN(id) CONCAT(FullConn_, id)
 
-#define DECL_LAYER(type, id) \
-  static void type(id)(float *in, float *out, float *weight, float *bias)
+// weight & bias arrays embedded by generator
+#define EMBEDDED_WEIGHT(id) CONCAT(kWeight_, id)
+#define EMBEDDED_BIAS(id) CONCAT(kBias_, id)
+
+// row pointers & column indices of sparse weights embedded by generator,
+// values are stored in `EMBEDDED_WEIGHT(id)`
+#define EMBEDDED_SPARSE_PTR(id) CONCAT(kSparsePtr_, id)
+#define EMBEDDED_SPARSE_IDX(id) CONCAT(kSparseIdx_, id)
+
+#define DECL_LAYER(type, id)                                       \
+  static void type(id)(const float *in, float *out,                \
+                       const float *weight, const float *bias)
+
+// shape of the padded raw input of the first layer
+#define RAW_PADDED_WIDTH (RAW_WIDTH + 2 * INPUT_PAD_X)
+#define RAW_PADDED_HEIGHT (RAW_HEIGHT + 2 * INPUT_PAD_Y)
+#define RAW_SIZE (RAW_WIDTH * RAW_HEIGHT * RAW_DEPTH)
+
+// read element (x, y, channel) of the padded raw input and apply the
+// affine transform, padding elements are read as raw zeros
+#define READ_RAW_INPUT(raw, x, y, channel)                            \
+  (((size_t)(x)-INPUT_PAD_X < RAW_WIDTH &&                            \
+            (size_t)(y)-INPUT_PAD_Y < RAW_HEIGHT                      \
+        ? static_cast<float>(                                         \
+              (raw)[((channel)*RAW_HEIGHT + (y)-INPUT_PAD_Y) *        \
+                        RAW_WIDTH +                                   \
+                    (x)-INPUT_PAD_X])                                 \
+        : 0.0f) *                                                     \
+       INPUT_SCALE +                                                  \
+   INPUT_OFFSET)
+
+// read the i-th element of the padded raw input
+#define READ_RAW_INDEX(raw, i)                                   \
+  READ_RAW_INPUT(raw, (i) % RAW_PADDED_WIDTH,                    \
+                 (i) / RAW_PADDED_WIDTH % RAW_PADDED_HEIGHT,     \
+                 (i) / (RAW_PADDED_WIDTH * RAW_PADDED_HEIGHT))
 
 inline size_t GetIndex(size_t x, size_t y, size_t channel, size_t width,
                        size_t height, size_t depth) {
@@ -6,23 +6,100 @@
 #define INPUT_SIZE 120
 #define OUTPUT_SIZE 10
 #define ACTIVATION tanh
+#define PARALLEL_THREADS 4
 #endif  // GENERATED
 
+// use SIMD for blocks of sparse weights
+#if defined(SPARSE_WEIGHT) && defined(SIMD)
+#if SPARSE_BLOCK % SIMD_VEC_LEN == 0
+#define SPARSE_SIMD
+#endif
+#endif
+
 DECL_LAYER(FULL_CONN, LAYER_ID) {
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif  // _OPENMP
+#if defined(SPARSE_WEIGHT)
+  // nonzero blocks of weights in CSR format, each row contains blocks of
+  // SPARSE_BLOCK consecutive outputs, column indices are inputs
+  const auto ptr = EMBEDDED_SPARSE_PTR(LAYER_ID);
+  const auto idx = EMBEDDED_SPARSE_IDX(LAYER_ID);
+  constexpr size_t kBlockNum =
+      (OUTPUT_SIZE + SPARSE_BLOCK - 1) / SPARSE_BLOCK;
+#if defined(_OPENMP) && PARALLEL_THREADS > 1
+#pragma omp parallel for num_threads(LAYER_THREADS)
+#endif  // _OPENMP && PARALLEL_THREADS > 1
+  for (size_t b = 0; b < kBlockNum; ++b) {
+    float sum[SPARSE_BLOCK];
+#ifdef SPARSE_SIMD
+    VecN mm_sum[SPARSE_BLOCK / SIMD_VEC_LEN];
+    for (auto &mm : mm_sum) mm = SIMD_MM(setzero_ps)();
+    for (auto k = ptr[b]; k < ptr[b + 1]; ++k) {
+      VecN mm_in = SIMD_MM(set1_ps)(in[idx[k]]);
+      const float *pw = weight + k * SPARSE_BLOCK;
+      for (size_t j = 0; j < SPARSE_BLOCK / SIMD_VEC_LEN; ++j) {
+        VecN mm_weight = SIMD_MM(loadu_ps)(pw + j * SIMD_VEC_LEN);
+        mm_sum[j] =
+            SIMD_MM(add_ps)(mm_sum[j], SIMD_MM(mul_ps)(mm_weight, mm_in));
+      }
+    }
+    for (size_t j = 0; j < SPARSE_BLOCK / SIMD_VEC_LEN; ++j) {
+      SIMD_MM(storeu_ps)(sum + j * SIMD_VEC_LEN, mm_sum[j]);
+    }
+#else
+    std::fill(sum, sum + SPARSE_BLOCK, 0.0f);
+    for (auto k = ptr[b]; k < ptr[b + 1]; ++k) {
+      const float *pw = weight + k * SPARSE_BLOCK;
+      for (size_t j = 0; j < SPARSE_BLOCK; ++j) {
+        sum[j] += pw[j] * in[idx[k]];
+      }
+    }
+#endif  // SPARSE_SIMD
+    // add bias and perform activation
+    for (size_t j = 0; j < SPARSE_BLOCK; ++j) {
+      auto i = b * SPARSE_BLOCK + j;
+      if (i < OUTPUT_SIZE) out[i] = ACT_FUNC(ACTIVATION)(sum[j] + bias[i]);
+    }
+  }
+#else
+#ifdef RAW_INPUT
+  const auto raw = reinterpret_cast<const RAW_INPUT_TYPE *>(in);
+#endif  // RAW_INPUT
+#if defined(_OPENMP) && PARALLEL_THREADS > 1
+#pragma omp parallel for num_threads(LAYER_THREADS)
+#endif  // _OPENMP && PARALLEL_THREADS > 1
   for (size_t i = 0; i < OUTPUT_SIZE; i++) {
     out[i] = 0.0;
+#ifdef LAYER_UNROLL
+    UNROLL_LOOP(LAYER_UNROLL)
+#endif  // LAYER_UNROLL
     for (size_t c = 0; c < INPUT_SIZE; c++) {
+#ifdef RAW_INPUT
+      out[i] += weight[c * OUTPUT_SIZE + i] * READ_RAW_INDEX(raw, c);
+#else
       out[i] += weight[c * OUTPUT_SIZE + i] * in[c];
+#endif  // RAW_INPUT
     }
     out[i] += bias[i];
     out[i] = ACT_FUNC(ACTIVATION)(out[i]);
   }
+#endif  // SPARSE_WEIGHT
 }
 
 #undef LAYER_ID
 #undef INPUT_SIZE
 #undef OUTPUT_SIZE
 #undef ACTIVATION
+#undef RAW_INPUT
+#undef RAW_INPUT_TYPE
+#undef RAW_WIDTH
+#undef RAW_HEIGHT
+#undef RAW_DEPTH
+#undef INPUT_PAD_X
+#undef INPUT_PAD_Y
+#undef INPUT_SCALE
+#undef INPUT_OFFSET
+#undef SPARSE_WEIGHT
+#undef SPARSE_BLOCK
+#undef SPARSE_SIMD
+#undef PARALLEL_THREADS
+#undef PARALLEL_OUTER
+#undef LAYER_UNROLL
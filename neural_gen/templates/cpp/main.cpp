@@ -2,6 +2,9 @@
 #include "define.h"
 #define NETWORK_LAYERS(e) e(CONV_3D, 0, 100) e(FULL_CONN, 1, 10)
 #define OUTPUT_SIZE 10
+#define INPUT_TYPE float
+#define INPUT_SIZE 1024
+#define NETWORK_COSTS(e) e(0, 1000) e(1, 100)
 #endif  // GENERATED
 
 // expand declarations of all layers
@@ -11,6 +14,13 @@ NETWORK_LAYERS(DECL_EXPANDER);
 
 namespace {
 
+// pointer to float array
+using FloatArr = std::unique_ptr<float[]>;
+
+// activations (outputs) of all layers, reused by inferences
+using Activations = std::vector<FloatArr>;
+
+#ifndef EMBEDDED_MODEL
 /*
   Model File Format (field: bytes):
 
@@ -22,9 +32,6 @@ namespace {
   LAYERn_BIAS_DATA:   LAYERn_BIAS_SIZE * sizeof(float)
 */
 
-// pointer to float array
-using FloatArr = std::unique_ptr<float[]>;
-
 // model data (vector of (weight, bias) pairs)
 using ModelData = std::vector<std::pair<FloatArr, FloatArr>>;
 
@@ -40,7 +47,182 @@ struct ModelLayerHeader {
   uint32_t weight_size;
   uint32_t bias_size;
 };
+#endif  // EMBEDDED_MODEL
+
+#ifndef NGEN_LIBRARY
+/*
+  Result File Format (field: bytes):
+
+  MAGIC_NUMBER: 4
+  RECORD_NUM:   4
+  OUTPUT_SIZE:  4
+  TOP_K:        4
+  RECORDn:      OUTPUT_SIZE * sizeof(float), if TOP_K is zero
+                TOP_K * sizeof(TopKEntry), otherwise
+
+  Records are stored in the order of inputs.
+*/
+
+constexpr uint32_t kResFileMagicNum = 0x1909eca2;
+
+struct ResultFileHeader {
+  uint32_t magic;
+  uint32_t record_num;
+  uint32_t output_size;
+  uint32_t top_k;
+};
+
+// entry of top-k records, in descending order of scores
+struct TopKEntry {
+  uint32_t index;
+  float score;
+};
+
+// command line options
+struct Options {
+  // result file, results are dumped as text if empty
+  std::string_view result_file;
+  // number of entries of top-k records, zero for all logits
+  size_t top_k = 0;
+  // dump results as text even if the result file is specified
+  bool text = false;
+  // number of pipeline stages, zero for running layers sequentially
+  size_t stages = 0;
+  // run inferences on all NUMA nodes, with per-node model replicas
+  bool numa = false;
+  // memory budget (bytes) of the result cache, zero for disabling
+  size_t cache_size = 0;
+};
 
+// mapped result file
+struct ResultFile {
+  char *data = nullptr;
+  size_t size = 0;
+  size_t record_size = 0;
+  size_t top_k = 0;
+};
+
+Options options;
+ResultFile results;
+// hash of the model, identity of the model in result cache keys
+uint64_t model_hash;
+
+// parse a decimal number at the beginning of the string, returns
+// pointer to the rest of the string, or null if there is no number
+const char *ParseNumber(const char *str, size_t &value) {
+  if (!std::isdigit(static_cast<unsigned char>(*str))) return nullptr;
+  char *end;
+  value = std::strtoul(str, &end, 10);
+  return end;
+}
+
+// parse size in bytes, with an optional K/M/G suffix, returns false if
+// the string is not a number or the suffix is unknown
+bool ParseSize(const char *str, size_t &size) {
+  auto end = ParseNumber(str, size);
+  if (!end) return false;
+  if (!*end) return true;
+  if (end[1]) return false;
+  switch (*end) {
+    case 'G': size <<= 10; [[fallthrough]];
+    case 'M': size <<= 10; [[fallthrough]];
+    case 'K': size <<= 10; return true;
+    default: return false;
+  }
+}
+
+// parse options, returns index of the first positional argument,
+// or zero if failed
+int ParseOptions(int argc, const char *argv[]) {
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; ++i) {
+    std::string_view opt = argv[i];
+    if (opt == "-t") {
+      options.text = true;
+    }
+    else if (opt == "-o" && i + 1 < argc) {
+      options.result_file = argv[++i];
+    }
+    else if (opt == "-k" && i + 1 < argc) {
+      auto end = ParseNumber(argv[++i], options.top_k);
+      if (!end || *end || options.top_k > OUTPUT_SIZE) return 0;
+    }
+    else if (opt == "-p" && i + 1 < argc) {
+      auto end = ParseNumber(argv[++i], options.stages);
+      if (!end || *end || !options.stages) return 0;
+    }
+    else if (opt == "-n") {
+      options.numa = true;
+    }
+    else if (opt == "-c" && i + 1 < argc) {
+      if (!ParseSize(argv[++i], options.cache_size)) return 0;
+    }
+    else {
+      return 0;
+    }
+  }
+  if (options.stages && (options.numa || options.cache_size)) return 0;
+  if (options.result_file.empty()) {
+    if (options.top_k) return 0;
+    options.text = true;
+  }
+  return i;
+}
+
+// create the result file for the specific number of records, and map it
+void OpenResultFile(size_t record_num) {
+  results.top_k = options.top_k;
+  results.record_size = results.top_k ? results.top_k * sizeof(TopKEntry)
+                                      : OUTPUT_SIZE * sizeof(float);
+  results.size =
+      sizeof(ResultFileHeader) + record_num * results.record_size;
+  // create & map file
+  auto fd = open(std::string(options.result_file).c_str(),
+                 O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) throw std::runtime_error("Failed to create result file!");
+  auto failed = ftruncate(fd, results.size);
+  auto data = failed ? MAP_FAILED
+                     : mmap(nullptr, results.size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw std::runtime_error("Failed to map result file!");
+  }
+  results.data = static_cast<char *>(data);
+  // write header
+  ResultFileHeader rfh = {kResFileMagicNum,
+                          static_cast<uint32_t>(record_num), OUTPUT_SIZE,
+                          static_cast<uint32_t>(results.top_k)};
+  std::memcpy(results.data, &rfh, sizeof(ResultFileHeader));
+}
+
+// unmap the result file
+void CloseResultFile() {
+  if (results.data) munmap(results.data, results.size);
+}
+
+// write record of the specific input to the result file
+void WriteRecord(size_t index, const float *output) {
+  auto record = results.data + sizeof(ResultFileHeader) +
+                index * results.record_size;
+  if (!results.top_k) {
+    std::memcpy(record, output, results.record_size);
+    return;
+  }
+  // select top-k outputs
+  uint32_t indices[OUTPUT_SIZE];
+  std::iota(indices, indices + OUTPUT_SIZE, 0);
+  std::partial_sort(
+      indices, indices + results.top_k, indices + OUTPUT_SIZE,
+      [output](uint32_t l, uint32_t r) { return output[l] > output[r]; });
+  auto entries = reinterpret_cast<TopKEntry *>(record);
+  for (size_t i = 0; i < results.top_k; ++i) {
+    entries[i] = {indices[i], output[indices[i]]};
+  }
+}
+#endif  // NGEN_LIBRARY
+
+#if !defined(NGEN_LIBRARY) || !defined(EMBEDDED_MODEL)
 // open file or fail
 void OpenFile(std::ifstream &ifs, std::string_view file) {
   ifs.close();
@@ -50,7 +232,9 @@ void OpenFile(std::ifstream &ifs, std::string_view file) {
     throw std::runtime_error("Failed to open file!");
   }
 }
+#endif  // !NGEN_LIBRARY || !EMBEDDED_MODEL
 
+#ifndef EMBEDDED_MODEL
 // read model from file
 ModelData ReadModel(std::istream &is) {
   // read file header
@@ -74,50 +258,636 @@ ModelData ReadModel(std::istream &is) {
   }
   return model;
 }
+#endif  // EMBEDDED_MODEL
+
+#ifndef NGEN_LIBRARY
+// read input from file to the specific buffer, inputs are truncated or
+// padded with zeros
+void ReadInput(std::istream &is, INPUT_TYPE *input) {
+  is.read(reinterpret_cast<char *>(input),
+          INPUT_SIZE * sizeof(INPUT_TYPE));
+  if (is.bad()) throw std::runtime_error("File error!");
+  auto count = is.gcount() / sizeof(INPUT_TYPE);
+  std::fill(input + count, input + INPUT_SIZE, INPUT_TYPE());
+}
+#endif  // NGEN_LIBRARY
 
-// read input from file
-FloatArr ReadInput(std::istream &is) {
-  // read input
-  std::vector<float> arr;
-  while (!is.fail() && !is.eof()) {
-    float cur;
-    is.read(reinterpret_cast<char *>(&cur), sizeof(float));
-    arr.push_back(cur);
+#ifdef PERF_COUNTERS
+// hardware events counted per layer
+enum PerfEvent {
+  kCycles,
+  kInstructions,
+  kL1dMisses,
+  kLlcRefs,
+  kLlcMisses,
+  kFpOps,
+  kPerfEventNum,
+};
+
+using PerfCounts = std::array<double, kPerfEventNum>;
+using PerfFds = std::array<int, kPerfEventNum>;
+
+// statistics of a layer, summed over all calls
+struct PerfLayer {
+  const char *name;
+  size_t calls = 0;
+  // nanoseconds
+  double time = 0;
+  PerfCounts counts{};
+};
+
+struct PerfState {
+  // collect statistics in `Infer`
+  bool enabled = false;
+  // counters of all threads, -1 for unavailable ones
+  std::vector<PerfFds> fds;
+  std::array<bool, kPerfEventNum> available{};
+  std::vector<PerfLayer> layers;
+  // counters & time at the beginning of the current layer
+  PerfCounts begin_counts;
+  std::chrono::steady_clock::time_point begin_time;
+};
+
+PerfState perf;
+
+#ifdef __linux__
+// get raw config of retired single precision FP operations of the
+// current CPU vendor, returns zero if unknown
+uint64_t GetFpOpsConfig() {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx)) return 0;
+  char vendor[12];
+  std::memcpy(vendor, &ebx, 4);
+  std::memcpy(vendor + 4, &edx, 4);
+  std::memcpy(vendor + 8, &ecx, 4);
+  std::string_view name(vendor, sizeof(vendor));
+  // FP_ARITH_INST_RETIRED, scalar & packed single precision
+  if (name == "GenuineIntel") return 0xaac7;
+  // retired SSE/AVX FLOPs
+  if (name == "AuthenticAMD") return 0xff03;
+#endif  // __x86_64__ || __i386__
+  return 0;
+}
+
+// fill type & config of the specific event, returns false if the event
+// is not supported
+bool SetPerfEvent(PerfEvent event, perf_event_attr &attr) {
+  switch (event) {
+    case kCycles:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CPU_CYCLES;
+      return true;
+    case kInstructions:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+      return true;
+    case kL1dMisses:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_L1D |
+                    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      return true;
+    case kLlcRefs:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CACHE_REFERENCES;
+      return true;
+    case kLlcMisses:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CACHE_MISSES;
+      return true;
+    case kFpOps:
+      attr.type = PERF_TYPE_RAW;
+      attr.config = GetFpOpsConfig();
+      return attr.config;
+    default:
+      return false;
   }
-  if (is.fail() && !is.eof()) throw std::runtime_error("File error!");
-  // copy to float array
-  auto input = std::make_unique<float[]>(arr.size());
-  std::memcpy(input.get(), arr.data(), arr.size() * sizeof(float));
-  return input;
 }
 
-// infer
-FloatArr Infer(const ModelData &model, FloatArr input) {
-#define NETWORK_EXPANDER(type, id, out_size)                   \
-  do {                                                         \
-    auto output = std::make_unique<float[]>(out_size);         \
-    type(id)(input.get(), output.get(), model[id].first.get(), \
-             model[id].second.get());                          \
-    input = std::move(output);                                 \
+// open counters of the calling thread, counters are opened separately
+// (not as a group) so that they are multiplexed if there are not enough
+// hardware counters, returns the `errno` of the first failure in `error`
+PerfFds OpenPerfCounters(int &error) {
+  PerfFds fds;
+  for (int i = 0; i < kPerfEventNum; ++i) {
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    fds[i] = -1;
+    if (!SetPerfEvent(static_cast<PerfEvent>(i), attr)) continue;
+    fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fds[i] < 0 && !error) error = errno;
+  }
+  return fds;
+}
+#endif  // __linux__
+
+// read counters summed over all threads, scaled by the fraction of time
+// they were actually counting
+PerfCounts ReadPerfCounters() {
+  PerfCounts counts{};
+  for (const auto &fds : perf.fds) {
+    for (int i = 0; i < kPerfEventNum; ++i) {
+      // value, time enabled, time running
+      uint64_t value[3];
+      if (fds[i] < 0 ||
+          read(fds[i], value, sizeof(value)) != sizeof(value) ||
+          !value[2]) {
+        continue;
+      }
+      counts[i] += static_cast<double>(value[0]) * value[1] / value[2];
+    }
+  }
+  return counts;
+}
+
+// open counters on all OpenMP threads (or the main thread) and enable
+// collecting statistics, layers are only timed if counters are
+// unavailable (e.g. in containers or virtual machines)
+void InitPerf() {
+#define NETWORK_EXPANDER(type, id, out_size) \
+  perf.layers.push_back({#type " " #id});
+
+  NETWORK_LAYERS(NETWORK_EXPANDER);
+
+#undef NETWORK_EXPANDER
+
+  int error = 0;
+#ifdef __linux__
+#ifdef _OPENMP
+#pragma omp parallel
+#endif  // _OPENMP
+  {
+    int thread_error = 0;
+    auto fds = OpenPerfCounters(thread_error);
+#ifdef _OPENMP
+#pragma omp critical
+#endif  // _OPENMP
+    {
+      perf.fds.push_back(fds);
+      if (!error) error = thread_error;
+    }
+  }
+  for (const auto &fds : perf.fds) {
+    for (int i = 0; i < kPerfEventNum; ++i) {
+      if (fds[i] >= 0) perf.available[i] = true;
+    }
+  }
+#else
+  error = ENOSYS;
+#endif  // __linux__
+  if (!perf.available[kCycles]) {
+    std::cerr << "Hardware counters unavailable (" << std::strerror(error)
+              << "), only timing layers." << std::endl;
+  }
+  perf.enabled = true;
+}
+
+void BeginLayerPerf() {
+  if (!perf.enabled) return;
+  perf.begin_counts = ReadPerfCounters();
+  perf.begin_time = std::chrono::steady_clock::now();
+}
+
+void EndLayerPerf(size_t index) {
+  if (!perf.enabled) return;
+  auto end_time = std::chrono::steady_clock::now();
+  auto end_counts = ReadPerfCounters();
+  auto &layer = perf.layers[index];
+  ++layer.calls;
+  layer.time += std::chrono::duration<double, std::nano>(
+                    end_time - perf.begin_time)
+                    .count();
+  for (int i = 0; i < kPerfEventNum; ++i) {
+    layer.counts[i] += end_counts[i] - perf.begin_counts[i];
+  }
+}
+
+// print statistics (per call) of all layers to stderr, including IPC,
+// L1D misses per thousand instructions and the LLC miss rate,
+// unavailable values are printed as '-'
+void ReportPerf() {
+  auto print = [](bool available, double value, int width, int prec) {
+    if (available) {
+      std::cerr << std::setw(width) << std::setprecision(prec) << value;
+    }
+    else {
+      std::cerr << std::setw(width) << '-';
+    }
+  };
+  const auto &avail = perf.available;
+  std::cerr << std::left << std::setw(16) << "Layer" << std::right
+            << std::setw(8) << "Calls" << std::setw(12) << "Time(us)"
+            << std::setw(14) << "Cycles" << std::setw(14) << "Instrs"
+            << std::setw(7) << "IPC" << std::setw(10) << "L1D MPKI"
+            << std::setw(11) << "LLC miss%" << std::setw(14) << "FP ops"
+            << std::endl;
+  std::cerr << std::fixed;
+  for (const auto &layer : perf.layers) {
+    double calls = std::max<size_t>(layer.calls, 1);
+    const auto &counts = layer.counts;
+    std::cerr << std::left << std::setw(16) << layer.name << std::right
+              << std::setw(8) << layer.calls;
+    print(true, layer.time / calls / 1000, 12, 2);
+    print(avail[kCycles], counts[kCycles] / calls, 14, 0);
+    print(avail[kInstructions], counts[kInstructions] / calls, 14, 0);
+    print(avail[kCycles] && avail[kInstructions] && counts[kCycles],
+          counts[kInstructions] / counts[kCycles], 7, 2);
+    print(avail[kL1dMisses] && avail[kInstructions] &&
+              counts[kInstructions],
+          counts[kL1dMisses] * 1000 / counts[kInstructions], 10, 2);
+    print(avail[kLlcRefs] && avail[kLlcMisses] && counts[kLlcRefs],
+          counts[kLlcMisses] * 100 / counts[kLlcRefs], 11, 2);
+    print(avail[kFpOps], counts[kFpOps] / calls, 14, 0);
+    std::cerr << std::endl;
+  }
+  std::cerr << std::defaultfloat;
+}
+
+// collect statistics of the layer called between them
+#define PERF_BEGIN_LAYER() BeginLayerPerf()
+#define PERF_END_LAYER(index) EndLayerPerf(index)
+#else
+#define PERF_BEGIN_LAYER()
+#define PERF_END_LAYER(index)
+#endif  // PERF_COUNTERS
+
+#ifdef EMBEDDED_MODEL
+// weight & bias of layers, embedded in the binary
+#define LAYER_PARAMS(id) EMBEDDED_WEIGHT(id), EMBEDDED_BIAS(id)
+#else
+// weight & bias of layers, read from model file
+#define LAYER_PARAMS(id) model[id].first.get(), model[id].second.get()
+#endif  // EMBEDDED_MODEL
+
+// allocate activations of all layers
+Activations NewActivations() {
+#define NETWORK_EXPANDER(type, id, out_size) \
+  acts.push_back(std::make_unique<float[]>(out_size));
+
+  Activations acts;
+  NETWORK_LAYERS(NETWORK_EXPANDER);
+  return acts;
+
+#undef NETWORK_EXPANDER
+}
+
+// infer, returns outputs stored in the last activation
+#ifdef EMBEDDED_MODEL
+const float *Infer(const INPUT_TYPE *input, Activations &acts) {
+#else
+const float *Infer(const ModelData &model, const INPUT_TYPE *input,
+                   Activations &acts) {
+#endif  // EMBEDDED_MODEL
+#define NETWORK_EXPANDER(type, id, out_size)                         \
+  do {                                                               \
+    auto out = acts[index].get();                                    \
+    PERF_BEGIN_LAYER();                                              \
+    type(id)(static_cast<const float *>(in), out, LAYER_PARAMS(id)); \
+    PERF_END_LAYER(index);                                           \
+    in = out;                                                        \
+    ++index;                                                         \
   } while (0);
 
+  // the first layer reads the input (may be raw data) directly
+  const void *in = input;
+  size_t index = 0;
+  NETWORK_LAYERS(NETWORK_EXPANDER);
+  return static_cast<const float *>(in);
+
+#undef NETWORK_EXPANDER
+}
+
+#ifdef NGEN_LIBRARY
+// infer on a batch of inputs layer by layer, so that weights of a layer
+// are reused by all inputs while they are still in cache,
+// outputs are stored in the last activation of each input
+#ifdef EMBEDDED_MODEL
+void InferBatch(const INPUT_TYPE *const inputs[], size_t count,
+                std::vector<Activations> &acts) {
+#else
+void InferBatch(const ModelData &model, const INPUT_TYPE *const inputs[],
+                size_t count, std::vector<Activations> &acts) {
+#endif  // EMBEDDED_MODEL
+#define NETWORK_EXPANDER(type, id, out_size)                   \
+  for (size_t i = 0; i < count; ++i) {                         \
+    auto out = acts[i][index].get();                           \
+    type(id)(static_cast<const float *>(ins[i]), out,          \
+             LAYER_PARAMS(id));                                \
+    ins[i] = out;                                              \
+  }                                                            \
+  ++index;
+
+  // the first layer reads inputs (may be raw data) directly
+  std::vector<const void *> ins(inputs, inputs + count);
+  size_t index = 0;
+  NETWORK_LAYERS(NETWORK_EXPANDER);
+
+#undef NETWORK_EXPANDER
+}
+#endif  // NGEN_LIBRARY
+
+// number of lock stripes of the result cache
+constexpr size_t kCacheStripes = 16;
+
+// estimated bytes of bookkeeping (list & hash map nodes) per cache entry
+constexpr size_t kCacheEntryOverhead = 64;
+
+// key of cached results, inputs are looked up by their hashes
+struct CacheKey {
+  uint64_t model;
+  uint64_t input;
+
+  bool operator==(const CacheKey &key) const {
+    return model == key.model && input == key.input;
+  }
+};
+
+// seeds of mixing hashes of keys, for hash maps & stripes respectively
+constexpr uint64_t kCacheMapSeed = 0;
+constexpr uint64_t kCacheStripeSeed = 0x165667b19e3779f9ULL;
+
+// cached outputs of an input, the input is stored to tell it from other
+// inputs with the same hash
+struct CacheEntry {
+  CacheKey key;
+  INPUT_TYPE input[INPUT_SIZE];
+  float output[OUTPUT_SIZE];
+};
+
+// minimum memory budget (bytes) of the result cache, one entry per stripe
+constexpr size_t kMinCacheSize =
+    (sizeof(CacheEntry) + kCacheEntryOverhead) * kCacheStripes;
+
+// hash the specific bytes (64-bit, not cryptographic)
+uint64_t HashBytes(const void *data, size_t size, uint64_t seed = 0) {
+  constexpr uint64_t kPrime1 = 0x9e3779b185ebca87ULL;
+  constexpr uint64_t kPrime2 = 0xc2b2ae3d27d4eb4fULL;
+  auto round = [](uint64_t h, uint64_t word) {
+    h += word * kPrime2;
+    return ((h << 31) | (h >> 33)) * kPrime1;
+  };
+  auto bytes = static_cast<const unsigned char *>(data);
+  // consume 4 independent lanes of 8-byte words
+  uint64_t lanes[4] = {seed + kPrime1 + kPrime2, seed + kPrime2, seed,
+                       seed - kPrime1};
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    for (size_t j = 0; j < 4; ++j) {
+      uint64_t word;
+      std::memcpy(&word, bytes + i + j * 8, 8);
+      lanes[j] = round(lanes[j], word);
+    }
+  }
+  uint64_t h = size * kPrime1;
+  for (auto lane : lanes) h = round(h ^ round(0, lane), kPrime1);
+  // consume the remaining bytes
+  for (; i < size; i += 8) {
+    uint64_t word = 0;
+    std::memcpy(&word, bytes + i, std::min<size_t>(size - i, 8));
+    h = round(h ^ round(0, word), kPrime1);
+  }
+  // finalize, avalanche all bits
+  h ^= h >> 33;
+  h *= kPrime2;
+  h ^= h >> 29;
+  h *= kPrime1;
+  return h ^ (h >> 32);
+}
+
+// mix hashes of the model & the input of the specific key
+uint64_t MixCacheKey(const CacheKey &key, uint64_t seed) {
+  uint64_t words[2] = {key.model, key.input};
+  return HashBytes(words, sizeof(words), seed);
+}
+
+struct CacheKeyHash {
+  size_t operator()(const CacheKey &key) const {
+    return MixCacheKey(key, kCacheMapSeed);
+  }
+};
+
+// stripe of the result cache, with its own lock & LRU list
+struct CacheStripe {
+  std::mutex mutex;
+  // entries in the order of use, the most recently used first
+  std::list<CacheEntry> lru;
+  std::unordered_map<CacheKey, std::list<CacheEntry>::iterator,
+                     CacheKeyHash>
+      entries;
+  size_t capacity = 0;
+};
+
+// result cache shared by all threads (and networks), disabled if the
+// capacity is zero
+CacheStripe cache_stripes[kCacheStripes];
+std::atomic<size_t> cache_capacity;
+std::atomic<uint64_t> cache_hits, cache_misses;
+
+// get hash of the model, as the identity of the model in cache keys
+#ifdef EMBEDDED_MODEL
+uint64_t GetModelHash() {
+#define NETWORK_EXPANDER(type, id, out_size)                        \
+  hash = HashBytes(EMBEDDED_WEIGHT(id), sizeof(EMBEDDED_WEIGHT(id)), \
+                   hash);                                           \
+  hash = HashBytes(EMBEDDED_BIAS(id), sizeof(EMBEDDED_BIAS(id)), hash);
+
+  uint64_t hash = 0;
+  NETWORK_LAYERS(NETWORK_EXPANDER);
+  return hash;
+
+#undef NETWORK_EXPANDER
+}
+#else
+uint64_t GetModelHash(std::string_view model_file) {
+  std::ifstream ifs;
+  OpenFile(ifs, model_file);
+  std::string data(std::istreambuf_iterator<char>(ifs), {});
+  return HashBytes(data.data(), data.size());
+}
+#endif  // EMBEDDED_MODEL
+
+// enable the result cache with the specific memory budget in bytes,
+// or disable it if the budget is zero, cached results are dropped
+void InitCache(size_t bytes) {
+  if (bytes && bytes < kMinCacheSize) {
+    throw std::runtime_error("Memory budget of result cache is too small!");
+  }
+  auto stripe_capacity = bytes /
+                         (sizeof(CacheEntry) + kCacheEntryOverhead) /
+                         kCacheStripes;
+  for (auto &stripe : cache_stripes) {
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    stripe.lru.clear();
+    stripe.entries.clear();
+    stripe.capacity = stripe_capacity;
+  }
+  cache_capacity = stripe_capacity * kCacheStripes;
+}
+
+// get the stripe of the specific key
+CacheStripe &GetCacheStripe(const CacheKey &key) {
+  // mixed with another seed, independent of buckets of hash maps
+  auto hash = MixCacheKey(key, kCacheStripeSeed);
+  return cache_stripes[hash % kCacheStripes];
+}
+
+// look up outputs of the specific key & input, returns true if hit
+bool LookupCache(const CacheKey &key, const INPUT_TYPE *input,
+                 float *output) {
+  auto &stripe = GetCacheStripe(key);
+  {
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto it = stripe.entries.find(key);
+    // entries of other inputs with the same hash are misses, inputs are
+    // compared bytewise as they are hashed
+    if (it != stripe.entries.end() &&
+        !std::memcmp(input, it->second->input, sizeof(CacheEntry::input))) {
+      // mark as the most recently used
+      stripe.lru.splice(stripe.lru.begin(), stripe.lru, it->second);
+      std::copy_n(it->second->output, OUTPUT_SIZE, output);
+      cache_hits.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  cache_misses.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+// insert outputs of the specific key & input, evicts the least recently
+// used entry of the stripe if it is full
+void InsertCache(const CacheKey &key, const INPUT_TYPE *input,
+                 const float *output) {
+  auto &stripe = GetCacheStripe(key);
+  std::lock_guard<std::mutex> lock(stripe.mutex);
+  if (!stripe.capacity || stripe.entries.count(key)) return;
+  if (stripe.lru.size() < stripe.capacity) {
+    stripe.lru.emplace_front();
+  }
+  else {
+    // reuse the evicted entry
+    stripe.entries.erase(stripe.lru.back().key);
+    stripe.lru.splice(stripe.lru.begin(), stripe.lru,
+                      std::prev(stripe.lru.end()));
+  }
+  auto &entry = stripe.lru.front();
+  entry.key = key;
+  std::copy_n(input, INPUT_SIZE, entry.input);
+  std::copy_n(output, OUTPUT_SIZE, entry.output);
+  stripe.entries.emplace(key, stripe.lru.begin());
+}
+
+// infer through the result cache if it is enabled,
+// returns outputs stored in the last activation
+#ifdef EMBEDDED_MODEL
+const float *InferCached(uint64_t model_hash, const INPUT_TYPE *input,
+                         Activations &acts) {
+  if (!cache_capacity) return Infer(input, acts);
+#else
+const float *InferCached(const ModelData &model, uint64_t model_hash,
+                         const INPUT_TYPE *input, Activations &acts) {
+  if (!cache_capacity) return Infer(model, input, acts);
+#endif  // EMBEDDED_MODEL
+  CacheKey key = {model_hash,
+                  HashBytes(input, INPUT_SIZE * sizeof(INPUT_TYPE))};
+  auto output = acts.back().get();
+  if (LookupCache(key, input, output)) return output;
+#ifdef EMBEDDED_MODEL
+  Infer(input, acts);
+#else
+  Infer(model, input, acts);
+#endif  // EMBEDDED_MODEL
+  InsertCache(key, input, output);
+  return output;
+}
+
+#ifdef NGEN_LIBRARY
+// single-input inference request, queued by the batcher
+struct BatchRequest {
+  const INPUT_TYPE *input;
+  float *output;
+  // time of arrival, a batch is formed before the oldest request in the
+  // queue times out
+  std::chrono::steady_clock::time_point arrival;
+  bool done = false;
+  std::exception_ptr error;
+};
+
+// batcher of concurrent single-input requests, one of the requesting
+// threads becomes the leader, which collects requests until the batch is
+// full or the oldest request times out, and runs the batch for others
+struct Batcher {
+  // maximum batch size, batching is disabled if less than 2
+  std::atomic<size_t> max_size{0};
+  // maximum time of waiting for a full batch
+  std::chrono::microseconds timeout{0};
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::vector<BatchRequest *> queue;
+  // whether there is a leader forming or running a batch
+  bool leading = false;
+  // activations of inputs of the batch, only used by the leader
+  std::vector<Activations> acts;
+};
+#endif  // NGEN_LIBRARY
+
+#ifndef NGEN_LIBRARY
+// layer of network, for running layers in pipeline stages
+struct LayerInfo {
+  void (*run)(const float *, float *, const float *, const float *);
+  const float *weight;
+  const float *bias;
+  size_t out_size;
+  size_t cost;
+};
+
+// get estimated cost of the specific layer
+size_t GetLayerCost(size_t id) {
+#define COST_EXPANDER(layer_id, cost) \
+  if (id == layer_id) return cost;
+
+  NETWORK_COSTS(COST_EXPANDER);
+  return 0;
+
+#undef COST_EXPANDER
+}
+
+// get information of all layers
+#ifdef EMBEDDED_MODEL
+std::vector<LayerInfo> GetLayers() {
+#else
+std::vector<LayerInfo> GetLayers(const ModelData &model) {
+#endif  // EMBEDDED_MODEL
+#define NETWORK_EXPANDER(type, id, out_size)                          \
+  layers.push_back(                                                   \
+      {type(id), LAYER_PARAMS(id), out_size, GetLayerCost(id)});
+
+  std::vector<LayerInfo> layers;
   NETWORK_LAYERS(NETWORK_EXPANDER);
-  return input;
+  return layers;
 
 #undef NETWORK_EXPANDER
 }
+#endif  // NGEN_LIBRARY
+
+#undef LAYER_PARAMS
 
+#ifndef NGEN_LIBRARY
 // dump output to stderr
-void DumpOutput(const FloatArr &output) {
+void DumpOutput(const float *output) {
   for (size_t i = 0; i < OUTPUT_SIZE; ++i) {
     if (i) std::cerr << ' ';
     std::cerr << output[i];
   }
-  std::cerr << std::endl;
+  std::cerr << '\n';
 }
 
 // get the index of the maximum output
-size_t GetMaxIndex(const FloatArr &output) {
+size_t GetMaxIndex(const float *output) {
   float max_elem = -1e9;
   size_t max_i = 0;
   for (size_t i = 0; i < OUTPUT_SIZE; ++i) {
@@ -129,12 +899,550 @@ size_t GetMaxIndex(const FloatArr &output) {
   return max_i;
 }
 
+// submit output of the specific input
+void SubmitOutput(size_t index, const float *output) {
+  if (results.data) WriteRecord(index, output);
+  if (options.text) {
+    DumpOutput(output);
+    std::cout << GetMaxIndex(output) << '\n';
+  }
+}
+
+// number of tensors in each ring buffer of the pipeline
+constexpr size_t kRingSize = 4;
+
+// lock-free single-producer single-consumer ring buffer of tensors
+struct Ring {
+  FloatArr slots[kRingSize];
+  // number of pushed & popped tensors, in separate cache lines
+  alignas(64) std::atomic<size_t> pushed{0};
+  alignas(64) std::atomic<size_t> popped{0};
+  // set by producer after pushing the last tensor
+  std::atomic<bool> closed{false};
+};
+
+// allocate slots of the specific number of floats for the ring buffer
+void InitRing(Ring &ring, size_t size) {
+  for (auto &slot : ring.slots) slot = std::make_unique<float[]>(size);
+}
+
+// wait for a free slot of the ring buffer, and return it
+float *BeginPush(Ring &ring) {
+  auto pushed = ring.pushed.load(std::memory_order_relaxed);
+  while (pushed - ring.popped.load(std::memory_order_acquire) ==
+         kRingSize) {
+    std::this_thread::yield();
+  }
+  return ring.slots[pushed % kRingSize].get();
+}
+
+// publish the slot returned by `BeginPush`
+void EndPush(Ring &ring) {
+  auto pushed = ring.pushed.load(std::memory_order_relaxed);
+  ring.pushed.store(pushed + 1, std::memory_order_release);
+}
+
+// mark the ring buffer as closed, no more tensors will be pushed
+void CloseRing(Ring &ring) {
+  ring.closed.store(true, std::memory_order_release);
+}
+
+// wait for a tensor in the ring buffer, and return it,
+// returns null if the ring buffer is closed and empty
+const float *BeginPop(Ring &ring) {
+  auto popped = ring.popped.load(std::memory_order_relaxed);
+  for (;;) {
+    // all pushes are visible if the ring buffer has been closed
+    auto closed = ring.closed.load(std::memory_order_acquire);
+    if (ring.pushed.load(std::memory_order_acquire) != popped) break;
+    if (closed) return nullptr;
+    std::this_thread::yield();
+  }
+  return ring.slots[popped % kRingSize].get();
+}
+
+// release the slot returned by `BeginPop`
+void EndPop(Ring &ring) {
+  auto popped = ring.popped.load(std::memory_order_relaxed);
+  ring.popped.store(popped + 1, std::memory_order_release);
+}
+
+// split layers into at most `stage_num` contiguous stages, minimizing the
+// maximum cost of stages, returns bounds of stages
+std::vector<size_t> SplitStages(const std::vector<LayerInfo> &layers,
+                                size_t stage_num) {
+  auto layer_num = layers.size();
+  stage_num = std::min(stage_num, layer_num);
+  // prefix sums of costs
+  std::vector<size_t> sums(layer_num + 1);
+  for (size_t i = 0; i < layer_num; ++i) {
+    sums[i + 1] = sums[i] + layers[i].cost;
+  }
+  // costs[k][i]: minimum maximum cost of splitting the first i layers
+  // into k stages, firsts[k][i]: first layer of the last stage
+  constexpr auto kInf = std::numeric_limits<size_t>::max();
+  std::vector<std::vector<size_t>> costs(
+      stage_num + 1, std::vector<size_t>(layer_num + 1, kInf));
+  auto firsts = costs;
+  costs[0][0] = 0;
+  for (size_t k = 1; k <= stage_num; ++k) {
+    for (size_t i = k; i <= layer_num; ++i) {
+      for (size_t j = k - 1; j < i; ++j) {
+        if (costs[k - 1][j] == kInf) continue;
+        auto cost = std::max(costs[k - 1][j], sums[i] - sums[j]);
+        if (cost < costs[k][i]) {
+          costs[k][i] = cost;
+          firsts[k][i] = j;
+        }
+      }
+    }
+  }
+  // get bounds of stages
+  std::vector<size_t> bounds(stage_num + 1, layer_num);
+  for (size_t k = stage_num; k > 0; --k) {
+    bounds[k - 1] = firsts[k][bounds[k]];
+  }
+  return bounds;
+}
+
+// get CPUs the current process can run on
+std::vector<int> GetCpus() {
+  std::vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t set;
+  if (!sched_getaffinity(0, sizeof(cpu_set_t), &set)) {
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+      if (CPU_ISSET(i, &set)) cpus.push_back(i);
+    }
+  }
+#endif  // __linux__
+  return cpus;
+}
+
+// pin the current thread to the specific CPUs, if supported
+void PinThread(const std::vector<int> &cpus) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto cpu : cpus) CPU_SET(cpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+#endif  // __linux__
+}
+
+// run layers [first, last) as a pipeline stage on the specific CPU,
+// until the input ring buffer is closed
+void RunStage(const std::vector<LayerInfo> &layers, size_t first,
+              size_t last, Ring &in, Ring &out, int cpu) {
+  if (cpu >= 0) PinThread({cpu});
+#ifdef _OPENMP
+  // layers of the stage run on a single core
+  omp_set_num_threads(1);
+#endif  // _OPENMP
+  // allocate activations inside the stage after pinning,
+  // so that they are local to the core
+  std::vector<FloatArr> acts;
+  for (auto i = first; i + 1 < last; ++i) {
+    acts.push_back(std::make_unique<float[]>(layers[i].out_size));
+  }
+  while (auto input = BeginPop(in)) {
+    auto output = BeginPush(out);
+    for (auto i = first; i < last; ++i) {
+      const auto &layer = layers[i];
+      auto cur = i + 1 < last ? acts[i - first].get() : output;
+      layer.run(input, cur, layer.weight, layer.bias);
+      input = cur;
+    }
+    EndPop(in);
+    EndPush(out);
+  }
+  CloseRing(out);
+}
+
+// run layers as a pipeline on the specific input files, each stage runs
+// on a dedicated core, and passes activations to the next stage through
+// ring buffers
+void RunPipeline(const std::vector<LayerInfo> &layers, const char *files[],
+                 size_t file_num) {
+  auto bounds = SplitStages(layers, options.stages);
+  auto stage_num = bounds.size() - 1;
+  // ring buffers of inputs, outputs of stages
+  auto rings = std::make_unique<Ring[]>(stage_num + 1);
+  auto input_size = INPUT_SIZE * sizeof(INPUT_TYPE);
+  InitRing(rings[0], (input_size + sizeof(float) - 1) / sizeof(float));
+  for (size_t i = 0; i < stage_num; ++i) {
+    InitRing(rings[i + 1], layers[bounds[i + 1] - 1].out_size);
+  }
+  // start stages, the first CPU is left for reading inputs & writing
+  // outputs if there are enough CPUs
+  auto cpus = GetCpus();
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < stage_num; ++i) {
+    auto cpu = cpus.empty() ? -1 : cpus[(i + 1) % cpus.size()];
+    threads.emplace_back(RunStage, std::cref(layers), bounds[i],
+                         bounds[i + 1], std::ref(rings[i]),
+                         std::ref(rings[i + 1]), cpu);
+  }
+  // collect outputs in order
+  threads.emplace_back([&rings, stage_num] {
+    auto &ring = rings[stage_num];
+    for (size_t i = 0; auto output = BeginPop(ring); ++i) {
+      SubmitOutput(i, output);
+      EndPop(ring);
+    }
+  });
+  // read inputs
+  std::ifstream ifs;
+  for (size_t i = 0; i < file_num; ++i) {
+    OpenFile(ifs, files[i]);
+    ReadInput(ifs, reinterpret_cast<INPUT_TYPE *>(BeginPush(rings[0])));
+    EndPush(rings[0]);
+  }
+  CloseRing(rings[0]);
+  for (auto &thread : threads) thread.join();
+}
+
+// NUMA node, with CPUs the current process can run on
+struct NumaNode {
+  int id;
+  std::vector<int> cpus;
+};
+
+// directory of NUMA nodes in sysfs
+constexpr const char *kNodeDir = "/sys/devices/system/node/";
+
+// input files
+const char **input_files;
+size_t input_num;
+#ifndef EMBEDDED_MODEL
+// model file, read by each NUMA node
+std::string_view model_file;
+#endif  // EMBEDDED_MODEL
+// index of the next input
+std::atomic<size_t> next_input;
+// mutex for dumping text outputs
+std::mutex output_mutex;
+// outputs that are not dumped yet, and index of the next output to dump
+std::map<size_t, FloatArr> pending_outputs;
+size_t next_dump;
+
+// read the first line of the specific file, empty if failed
+std::string ReadLine(const std::string &file) {
+  std::ifstream ifs(file);
+  std::string line;
+  std::getline(ifs, line);
+  return line;
+}
+
+// parse list of IDs in sysfs, like "0-3,8,10-11"
+std::vector<int> ParseIdList(std::string_view list) {
+  std::vector<int> ids;
+  while (!list.empty()) {
+    auto pos = list.find(',');
+    auto range = std::string(list.substr(0, pos));
+    auto dash = range.find('-');
+    auto first = std::strtol(range.c_str(), nullptr, 10);
+    auto last = dash == std::string::npos
+                    ? first
+                    : std::strtol(range.c_str() + dash + 1, nullptr, 10);
+    for (auto i = first; i <= last; ++i) ids.push_back(i);
+    if (pos == std::string_view::npos) break;
+    list.remove_prefix(pos + 1);
+  }
+  return ids;
+}
+
+// get NUMA nodes with CPUs the current process can run on
+std::vector<NumaNode> GetNumaNodes() {
+  auto cpus = GetCpus();
+  std::vector<NumaNode> nodes;
+  for (auto id : ParseIdList(ReadLine(std::string(kNodeDir) + "online"))) {
+    NumaNode node = {id, {}};
+    auto file = kNodeDir + ("node" + std::to_string(id)) + "/cpulist";
+    for (auto cpu : ParseIdList(ReadLine(file))) {
+      if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end()) {
+        node.cpus.push_back(cpu);
+      }
+    }
+    if (!node.cpus.empty()) nodes.push_back(std::move(node));
+  }
+  // treat as a single node if the topology is unknown
+  if (nodes.empty()) nodes.push_back({0, cpus});
+  return nodes;
+}
+
+// submit output of the specific input from any thread,
+// text outputs are dumped in the order of inputs
+void SubmitOutputInOrder(size_t index, const float *output) {
+  if (!options.text) return SubmitOutput(index, output);
+  std::lock_guard<std::mutex> lock(output_mutex);
+  auto &pending = pending_outputs[index];
+  pending = std::make_unique<float[]>(OUTPUT_SIZE);
+  std::copy_n(output, OUTPUT_SIZE, pending.get());
+  for (auto it = pending_outputs.begin();
+       it != pending_outputs.end() && it->first == next_dump;
+       it = pending_outputs.erase(it), ++next_dump) {
+    SubmitOutput(it->first, it->second.get());
+  }
+}
+
+// run inference on the specific NUMA node until all inputs are consumed
+void RunNumaNode(const NumaNode &node) {
+  // pin the current thread and its OpenMP threads to CPUs of the node
+  if (!node.cpus.empty()) {
+    PinThread(node.cpus);
+#ifdef _OPENMP
+    omp_set_num_threads(node.cpus.size());
+#pragma omp parallel
+    PinThread({node.cpus[omp_get_thread_num()]});
+#endif  // _OPENMP
+  }
+  // allocate model replica & activations after pinning,
+  // so that they are first touched by (and local to) the node
+  std::ifstream ifs;
+#ifndef EMBEDDED_MODEL
+  OpenFile(ifs, model_file);
+  auto model = ReadModel(ifs);
+#endif  // EMBEDDED_MODEL
+  auto acts = NewActivations();
+  auto input = std::make_unique<INPUT_TYPE[]>(INPUT_SIZE);
+  for (;;) {
+    auto i = next_input.fetch_add(1, std::memory_order_relaxed);
+    if (i >= input_num) break;
+    OpenFile(ifs, input_files[i]);
+    ReadInput(ifs, input.get());
+#ifdef EMBEDDED_MODEL
+    SubmitOutputInOrder(i, InferCached(model_hash, input.get(), acts));
+#else
+    SubmitOutputInOrder(i,
+                        InferCached(model, model_hash, input.get(), acts));
+#endif  // EMBEDDED_MODEL
+  }
+}
+
+// run inference on all NUMA nodes, the first node runs on the current
+// thread
+void RunNuma() {
+  auto nodes = GetNumaNodes();
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < nodes.size(); ++i) {
+    threads.emplace_back(RunNumaNode, std::cref(nodes[i]));
+  }
+  RunNumaNode(nodes[0]);
+  for (auto &thread : threads) thread.join();
+}
+#endif  // NGEN_LIBRARY
+
 }  // namespace
 
+#ifdef NGEN_LIBRARY
+// network loaded by library users
+struct ngen_network {
+#ifndef EMBEDDED_MODEL
+  ModelData model;
+#endif  // EMBEDDED_MODEL
+  // identity of the model in result cache keys
+  uint64_t model_hash;
+  Batcher batcher;
+};
+
+namespace {
+
+// message of the last error of the current thread
+thread_local std::string last_error;
+
+// run the specific function, returns non-zero and records the error
+// message if any exception was thrown
+template <typename Fn>
+int TryRun(Fn fn) {
+  try {
+    fn();
+    return 0;
+  }
+  catch (const std::exception &e) {
+    last_error = e.what();
+  }
+  catch (...) {
+    last_error = "Unknown error!";
+  }
+  return -1;
+}
+
+// run a batch of requests, the result cache is looked up first
+void RunBatch(ngen_network &net, const std::vector<BatchRequest *> &batch) {
+  auto &acts = net.batcher.acts;
+  while (acts.size() < batch.size()) acts.push_back(NewActivations());
+  // collect requests that miss the cache
+  bool cached = cache_capacity;
+  std::vector<BatchRequest *> misses;
+  std::vector<const INPUT_TYPE *> inputs;
+  std::vector<CacheKey> keys;
+  for (auto req : batch) {
+    if (cached) {
+      auto hash = HashBytes(req->input, INPUT_SIZE * sizeof(INPUT_TYPE));
+      CacheKey key = {net.model_hash, hash};
+      if (LookupCache(key, req->input, req->output)) continue;
+      keys.push_back(key);
+    }
+    misses.push_back(req);
+    inputs.push_back(req->input);
+  }
+  // infer & write back outputs
+#ifdef EMBEDDED_MODEL
+  InferBatch(inputs.data(), inputs.size(), acts);
+#else
+  InferBatch(net.model, inputs.data(), inputs.size(), acts);
+#endif  // EMBEDDED_MODEL
+  for (size_t i = 0; i < misses.size(); ++i) {
+    std::copy_n(acts[i].back().get(), OUTPUT_SIZE, misses[i]->output);
+    if (cached) InsertCache(keys[i], inputs[i], misses[i]->output);
+  }
+}
+
+// infer on an input through the batcher of the network
+void InferBatched(ngen_network &net, const INPUT_TYPE *input,
+                  float *output) {
+  auto &batcher = net.batcher;
+  BatchRequest req = {input, output, std::chrono::steady_clock::now()};
+  std::unique_lock<std::mutex> lock(batcher.mutex);
+  batcher.queue.push_back(&req);
+  batcher.cond.notify_all();
+  while (!req.done) {
+    if (batcher.leading) {
+      batcher.cond.wait(lock);
+      continue;
+    }
+    // become the leader, wait for a full batch until the oldest request
+    // times out
+    batcher.leading = true;
+    auto deadline = batcher.queue.front()->arrival + batcher.timeout;
+    batcher.cond.wait_until(lock, deadline, [&batcher] {
+      return batcher.queue.size() >= batcher.max_size;
+    });
+    auto count = std::min(batcher.queue.size(), batcher.max_size.load());
+    count = std::max<size_t>(count, 1);
+    std::vector<BatchRequest *> batch(batcher.queue.begin(),
+                                      batcher.queue.begin() + count);
+    batcher.queue.erase(batcher.queue.begin(),
+                        batcher.queue.begin() + count);
+    // run the batch without holding the lock
+    lock.unlock();
+    std::exception_ptr error;
+    try {
+      RunBatch(net, batch);
+    }
+    catch (...) {
+      error = std::current_exception();
+    }
+    lock.lock();
+    for (auto r : batch) {
+      r->error = error;
+      r->done = true;
+    }
+    batcher.leading = false;
+    batcher.cond.notify_all();
+  }
+  if (req.error) std::rethrow_exception(req.error);
+}
+
+}  // namespace
+
+int ngen_abi_version(void) { return NGEN_ABI_VERSION; }
+
+ngen_network *ngen_load(const char *model, unsigned platform,
+                        const char *device) {
+  ngen_network *net = nullptr;
+  TryRun([&] {
+    auto new_net = std::make_unique<ngen_network>();
+#ifndef EMBEDDED_MODEL
+    if (!model) throw std::runtime_error("Model file is not specified!");
+    std::ifstream ifs;
+    OpenFile(ifs, model);
+    new_net->model = ReadModel(ifs);
+    new_net->model_hash = GetModelHash(model);
+#else
+    new_net->model_hash = GetModelHash();
+#endif  // EMBEDDED_MODEL
+    net = new_net.release();
+  });
+  return net;
+}
+
+size_t ngen_input_size(const ngen_network *net) {
+  return INPUT_SIZE * sizeof(INPUT_TYPE);
+}
+
+size_t ngen_output_size(const ngen_network *net) { return OUTPUT_SIZE; }
+
+int ngen_infer(ngen_network *net, const void *input, float *output) {
+  if (!net || net->batcher.max_size < 2) {
+    return ngen_infer_batch(net, input, 1, output);
+  }
+  return TryRun([&] {
+    if (!input || !output) throw std::runtime_error("Invalid argument!");
+    InferBatched(*net, static_cast<const INPUT_TYPE *>(input), output);
+  });
+}
+
+int ngen_infer_batch(ngen_network *net, const void *inputs, size_t count,
+                     float *outputs) {
+  return TryRun([&] {
+    if (!net || (count && (!inputs || !outputs))) {
+      throw std::runtime_error("Invalid argument!");
+    }
+    auto input = static_cast<const INPUT_TYPE *>(inputs);
+    auto acts = NewActivations();
+    for (size_t i = 0; i < count; ++i) {
+      auto in = input + i * INPUT_SIZE;
+#ifdef EMBEDDED_MODEL
+      auto output = InferCached(net->model_hash, in, acts);
+#else
+      auto output = InferCached(net->model, net->model_hash, in, acts);
+#endif  // EMBEDDED_MODEL
+      std::copy_n(output, OUTPUT_SIZE, outputs + i * OUTPUT_SIZE);
+    }
+  });
+}
+
+int ngen_set_batching(ngen_network *net, size_t max_batch,
+                      unsigned timeout_us) {
+  return TryRun([&] {
+    if (!net) throw std::runtime_error("Invalid argument!");
+    std::lock_guard<std::mutex> lock(net->batcher.mutex);
+    net->batcher.max_size = max_batch;
+    net->batcher.timeout = std::chrono::microseconds(timeout_us);
+  });
+}
+
+void ngen_free(ngen_network *net) { delete net; }
+
+int ngen_cache_init(size_t bytes) {
+  return TryRun([&] { InitCache(bytes); });
+}
+
+void ngen_cache_stats(uint64_t *hits, uint64_t *misses) {
+  if (hits) *hits = cache_hits;
+  if (misses) *misses = cache_misses;
+}
+
+const char *ngen_last_error(void) { return last_error.c_str(); }
+#else
 int main(int argc, const char *argv[]) {
   // check & parse command line arguments
-  if (argc < 3) {
-    std::cerr << "Usage: " << argv[0] << " MODEL <INPUT ...>" << std::endl;
+  auto arg = ParseOptions(argc, argv);
+  if (arg && options.cache_size && options.cache_size < kMinCacheSize) {
+    std::cerr << "Memory budget of result cache must be at least "
+              << kMinCacheSize << " bytes." << std::endl;
+    arg = 0;
+  }
+#ifdef EMBEDDED_MODEL
+  if (!arg || argc - arg < 1) {
+    std::cerr << "Usage: " << argv[0] << " [-p STAGES | [-n] [-c SIZE]]"
+              << " [-o RESULT [-k K] [-t]] <INPUT ...>" << std::endl;
+#else
+  if (!arg || argc - arg < 2) {
+    std::cerr << "Usage: " << argv[0] << " [-p STAGES | [-n] [-c SIZE]]"
+              << " [-o RESULT [-k K] [-t]] MODEL <INPUT ...>" << std::endl;
+#endif  // EMBEDDED_MODEL
 #ifdef _OPENMP
 #pragma omp parallel
     {
@@ -146,24 +1454,82 @@ int main(int argc, const char *argv[]) {
 #endif  // _OPENMP
     return 1;
   }
-  std::string_view mod_file = argv[1];
-
-  // read model data
   std::ifstream ifs;
-  OpenFile(ifs, mod_file);
-  auto model = ReadModel(ifs);
 
-  // read inputs
-  for (int i = 2; i < argc; ++i) {
-    OpenFile(ifs, argv[i]);
-    auto input = ReadInput(ifs);
-    // infer
-    auto output = Infer(model, std::move(input));
-    DumpOutput(output);
-    std::cout << GetMaxIndex(output) << std::endl;
+#ifndef EMBEDDED_MODEL
+  // read model data, NUMA nodes read their own replicas
+  model_file = argv[arg++];
+  ModelData model;
+  if (!options.numa) {
+    OpenFile(ifs, model_file);
+    model = ReadModel(ifs);
+  }
+#endif  // EMBEDDED_MODEL
+
+  // initialize the result cache
+  if (options.cache_size) {
+    InitCache(options.cache_size);
+#ifdef EMBEDDED_MODEL
+    model_hash = GetModelHash();
+#else
+    model_hash = GetModelHash(model_file);
+#endif  // EMBEDDED_MODEL
+  }
+
+  // initialize outputs, text outputs are flushed only at exit
+  if (!options.result_file.empty()) OpenResultFile(argc - arg);
+  std::ios::sync_with_stdio(false);
+  std::cerr.unsetf(std::ios::unitbuf);
+
+  if (options.numa) {
+    // run on all NUMA nodes
+    input_files = argv + arg;
+    input_num = argc - arg;
+    RunNuma();
+  }
+  else if (options.stages) {
+    // run layers in pipeline stages
+#ifdef EMBEDDED_MODEL
+    RunPipeline(GetLayers(), argv + arg, argc - arg);
+#else
+    RunPipeline(GetLayers(model), argv + arg, argc - arg);
+#endif  // EMBEDDED_MODEL
+  }
+  else {
+    // read inputs & infer one by one
+#ifdef PERF_COUNTERS
+    InitPerf();
+#endif  // PERF_COUNTERS
+    auto acts = NewActivations();
+    auto input = std::make_unique<INPUT_TYPE[]>(INPUT_SIZE);
+    for (int i = arg; i < argc; ++i) {
+      OpenFile(ifs, argv[i]);
+      ReadInput(ifs, input.get());
+#ifdef EMBEDDED_MODEL
+      SubmitOutput(i - arg, InferCached(model_hash, input.get(), acts));
+#else
+      SubmitOutput(i - arg,
+                   InferCached(model, model_hash, input.get(), acts));
+#endif  // EMBEDDED_MODEL
+    }
+  }
+  CloseResultFile();
+#ifdef PERF_COUNTERS
+  if (perf.enabled) ReportPerf();
+#endif  // PERF_COUNTERS
+  if (cache_capacity) {
+    std::cerr << "Result cache: " << cache_hits << " hits, "
+              << cache_misses << " misses." << std::endl;
   }
+  std::cerr.flush();
   return 0;
 }
+#endif  // NGEN_LIBRARY
 
+#undef PERF_BEGIN_LAYER
+#undef PERF_END_LAYER
 #undef NETWORK_LAYERS
 #undef OUTPUT_SIZE
+#undef INPUT_TYPE
+#undef INPUT_SIZE
+#undef NETWORK_COSTS
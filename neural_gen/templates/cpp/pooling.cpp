@@ -15,16 +15,32 @@
 #define OUTPUT_HEIGHT 14
 #define OUTPUT_DEPTH 6
 #define ACTIVATION tanh
+#define PARALLEL_THREADS 4
 #endif  // GENERATED
 
+#ifdef RAW_INPUT
+#define POOL_INPUT(x, y) READ_RAW_INPUT(raw, x, y, i)
+#else
+#define POOL_INPUT(x, y) in[(y)*INPUT_WIDTH + (x) + block]
+#endif  // RAW_INPUT
+
 DECL_LAYER(POOLING, LAYER_ID) {
-#ifdef _OPENMP
-#pragma omp parallel for collapse(3)
-#endif  // _OPENMP
+#ifdef RAW_INPUT
+  const auto raw = reinterpret_cast<const RAW_INPUT_TYPE *>(in);
+#endif  // RAW_INPUT
+#if defined(_OPENMP) && PARALLEL_THREADS > 1
+#if defined(PARALLEL_OUTER)
+#pragma omp parallel for num_threads(LAYER_THREADS)
+#else
+#pragma omp parallel for collapse(3) num_threads(LAYER_THREADS)
+#endif
+#endif  // _OPENMP && PARALLEL_THREADS > 1
   for (size_t i = 0; i < OUTPUT_DEPTH; i++) {
     for (size_t y = 0; y < OUTPUT_HEIGHT; y++) {
       for (size_t x = 0; x < OUTPUT_WIDTH; x++) {
+#ifndef RAW_INPUT
         size_t block = INPUT_WIDTH * INPUT_HEIGHT * i;
+#endif  // RAW_INPUT
         size_t rows = y * KERNEL_WIDTH;
         size_t cols = x * KERNEL_HEIGHT;
         size_t index =
@@ -33,8 +49,7 @@ DECL_LAYER(POOLING, LAYER_ID) {
         out[index] = 0.0;
         for (size_t m = 0; m < KERNEL_WIDTH; m++) {
           for (size_t n = 0; n < KERNEL_HEIGHT; n++) {
-            out[index] +=
-                weight[i] * in[(rows + m) * INPUT_WIDTH + cols + n + block];
+            out[index] += weight[i] * POOL_INPUT(cols + n, rows + m);
           }
         }
         constexpr float kScaleFactor = 1.0 / (KERNEL_WIDTH * KERNEL_HEIGHT);
@@ -44,9 +59,7 @@ DECL_LAYER(POOLING, LAYER_ID) {
         for (size_t m = 0; m < KERNEL_WIDTH; m++) {
           for (size_t n = 0; n < KERNEL_HEIGHT; n++) {
             out[index] = std::max(
-                out[index],
-                weight[i] *
-                    in[(rows + m) * INPUT_WIDTH + cols + n + block]);
+                out[index], weight[i] * POOL_INPUT(cols + n, rows + m));
           }
         }
 #endif
@@ -57,6 +70,7 @@ DECL_LAYER(POOLING, LAYER_ID) {
   }
 }
 
+#undef POOL_INPUT
 #undef LAYER_ID
 #undef FUNCTION_AVERAGE
 #undef FUNCTION_MAX
@@ -72,3 +86,15 @@ DECL_LAYER(POOLING, LAYER_ID) {
 #undef OUTPUT_HEIGHT
 #undef OUTPUT_DEPTH
 #undef ACTIVATION
+#undef RAW_INPUT
+#undef RAW_INPUT_TYPE
+#undef RAW_WIDTH
+#undef RAW_HEIGHT
+#undef RAW_DEPTH
+#undef INPUT_PAD_X
+#undef INPUT_PAD_Y
+#undef INPUT_SCALE
+#undef INPUT_OFFSET
+#undef PARALLEL_THREADS
+#undef PARALLEL_OUTER
+#undef LAYER_UNROLL
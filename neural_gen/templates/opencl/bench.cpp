@@ -0,0 +1,261 @@
+#ifndef GENERATED
+const char *kOpenCLOptions = "-DOPT";
+const char *kOpenCLProgram = "";
+#define BENCH_VARIANTS(e) \
+  e(CONV_3D, 1_0, 1024, 4704, 150, 6, 6, 28, 28, 1, 14, 14)
+#define BENCH_REPEATS 50
+#define BATCH_SIZE 1
+#endif  // GENERATED
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#define CONCAT_IMPL(x, y) #x #y
+#define CONCAT(x, y) CONCAT_IMPL(x, y)
+
+#define CONV_3D(id) CONCAT(Conv3D_, id)
+#define POOLING(id) CONCAT(Pooling_, id)
+#define FULL_CONN(id) CONCAT(FullConn_, id)
+
+namespace {
+
+// pointer to OpenCL context
+using ContextPtr = std::unique_ptr<std::remove_pointer_t<cl_context>,
+                                   decltype(&clReleaseContext)>;
+// pointer to command queue
+using CmdQueuePtr = std::unique_ptr<std::remove_pointer_t<cl_command_queue>,
+                                    decltype(&clReleaseCommandQueue)>;
+// pointer to program
+using ProgramPtr = std::unique_ptr<std::remove_pointer_t<cl_program>,
+                                   decltype(&clReleaseProgram)>;
+// pointer to kernel
+using KernelPtr = std::unique_ptr<std::remove_pointer_t<cl_kernel>,
+                                  decltype(&clReleaseKernel)>;
+// pointer to OpenCL buffer
+using BufferPtr = std::unique_ptr<std::remove_pointer_t<cl_mem>,
+                                  decltype(&clReleaseMemObject)>;
+
+// the benchmarked device
+cl_device_id device;
+// OpenCL context, command queue & program
+ContextPtr context = {nullptr, nullptr};
+CmdQueuePtr cmd_queue = {nullptr, nullptr};
+ProgramPtr program = {nullptr, nullptr};
+
+// parse a number in device descriptor
+cl_uint ParseDeviceNumber(std::string_view str) {
+  std::string num(str);
+  char *end;
+  auto value = std::strtoul(num.c_str(), &end, 10);
+  if (num.empty() || !std::isdigit(static_cast<unsigned char>(num[0])) ||
+      *end || value > std::numeric_limits<cl_uint>::max()) {
+    throw std::runtime_error("invalid device configuration");
+  }
+  return value;
+}
+
+// select the OpenCL device, device descriptor can be:
+//   N:                   the N-th device of the platform
+//   all/cpu/gpu/acc:     the first device (of the specific type)
+void InitDevice(size_t platform_id, std::string_view dev_desc) {
+  // initialize platform info
+  cl_uint plat_num;
+  if (clGetPlatformIDs(0, nullptr, &plat_num) || plat_num <= platform_id) {
+    throw std::runtime_error("invalid platform configuration");
+  }
+  std::vector<cl_platform_id> plats(plat_num);
+  if (clGetPlatformIDs(plat_num, plats.data(), nullptr)) {
+    throw std::runtime_error("failed to read platform ids");
+  }
+  // parse device descriptor
+  const std::unordered_map<std::string_view, cl_device_type> kTypes = {
+      {"all", CL_DEVICE_TYPE_ALL},
+      {"cpu", CL_DEVICE_TYPE_CPU},
+      {"gpu", CL_DEVICE_TYPE_GPU},
+      {"acc", CL_DEVICE_TYPE_ACCELERATOR},
+  };
+  auto type = kTypes.find(dev_desc);
+  auto dev_type = type != kTypes.end() ? type->second : CL_DEVICE_TYPE_ALL;
+  cl_uint device_id =
+      type != kTypes.end() ? 0 : ParseDeviceNumber(dev_desc);
+  // select device
+  cl_uint dev_num;
+  if (clGetDeviceIDs(plats[platform_id], dev_type, 0, nullptr, &dev_num) ||
+      dev_num <= device_id) {
+    throw std::runtime_error("invalid device configuration");
+  }
+  std::vector<cl_device_id> plat_devs(dev_num);
+  if (clGetDeviceIDs(plats[platform_id], dev_type, dev_num,
+                     plat_devs.data(), nullptr)) {
+    throw std::runtime_error("failed to read device ids");
+  }
+  device = plat_devs[device_id];
+}
+
+// read the specific string info of the device
+std::string GetDeviceString(cl_device_info param) {
+  size_t size;
+  if (clGetDeviceInfo(device, param, 0, nullptr, &size)) {
+    throw std::runtime_error("failed to read device info");
+  }
+  std::string info(size, '\0');
+  if (clGetDeviceInfo(device, param, size, info.data(), nullptr)) {
+    throw std::runtime_error("failed to read device info");
+  }
+  // drop the trailing null characters
+  return info.c_str();
+}
+
+// get identity of the device, including its name, vendor, driver version
+// and the number of compute units
+std::string GetDeviceIdentity() {
+  cl_uint units;
+  if (clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint),
+                      &units, nullptr)) {
+    throw std::runtime_error("failed to read device info");
+  }
+  return GetDeviceString(CL_DEVICE_NAME) + " (" +
+         GetDeviceString(CL_DEVICE_VENDOR) + ", " +
+         GetDeviceString(CL_DRIVER_VERSION) + ") x" +
+         std::to_string(units);
+}
+
+// initialize context & command queue
+void InitContext() {
+  cl_int err;
+  context = ContextPtr(
+      clCreateContext(nullptr, 1, &device, nullptr, nullptr, &err),
+      clReleaseContext);
+  if (err) throw std::runtime_error("failed to create context");
+  cmd_queue = CmdQueuePtr(
+      clCreateCommandQueue(context.get(), device, 0, &err),
+      clReleaseCommandQueue);
+  if (err) throw std::runtime_error("failed to create command queue");
+}
+
+// load OpenCL program
+void LoadProgram() {
+  cl_int err;
+  program =
+      ProgramPtr(clCreateProgramWithSource(context.get(), 1,
+                                           &kOpenCLProgram, nullptr, &err),
+                 clReleaseProgram);
+  if (err) throw std::runtime_error("failed to create program");
+  if (clBuildProgram(program.get(), 1, &device, kOpenCLOptions, nullptr,
+                     nullptr)) {
+    // read compile log
+    size_t log_size;
+    clGetProgramBuildInfo(program.get(), device, CL_PROGRAM_BUILD_LOG, 0,
+                          nullptr, &log_size);
+    std::string comp_log;
+    comp_log.resize(log_size);
+    clGetProgramBuildInfo(program.get(), device, CL_PROGRAM_BUILD_LOG,
+                          log_size, comp_log.data(), nullptr);
+    throw std::runtime_error("failed to build program\n" + comp_log);
+  }
+}
+
+// create a buffer of the specific number of floats filled with the
+// specific value
+BufferPtr NewBuffer(size_t count, float value) {
+  std::vector<float> data(count, value);
+  cl_int err;
+  auto flags = CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR;
+  auto buffer = BufferPtr(clCreateBuffer(context.get(), flags,
+                                         count * sizeof(float), data.data(),
+                                         &err),
+                          clReleaseMemObject);
+  if (err) throw std::runtime_error("failed to create OpenCL buffer");
+  return buffer;
+}
+
+// measure the median time (in nanoseconds) of running a layer variant on
+// a batch, returns infinity if the variant can not run on the device,
+// `in_size` & `out_size` are numbers of floats per input, unused if
+// there is no variant (e.g. when only reading identity of the device)
+[[maybe_unused]] double Measure(const char *name, size_t in_size,
+                                size_t out_size, size_t weight_size,
+                                size_t bias_size, const size_t *global,
+                                const size_t *local) {
+  cl_int err;
+  auto kernel = KernelPtr(clCreateKernel(program.get(), name, &err),
+                          clReleaseKernel);
+  if (err) throw std::runtime_error("failed to create kernel");
+  auto in = NewBuffer(in_size * BATCH_SIZE, 0.5f);
+  auto out = NewBuffer(out_size * BATCH_SIZE, 0.0f);
+  auto weight = NewBuffer(weight_size, 0.01f);
+  auto bias = NewBuffer(bias_size, 0.1f);
+  cl_mem args[] = {in.get(), out.get(), weight.get(), bias.get()};
+  for (cl_uint i = 0; i < 4; ++i) {
+    if (clSetKernelArg(kernel.get(), i, sizeof(cl_mem), &args[i])) {
+      throw std::runtime_error("failed to set argument");
+    }
+  }
+  std::vector<double> times;
+  // the first run warms up the device
+  for (size_t i = 0; i <= BENCH_REPEATS; ++i) {
+    auto begin = std::chrono::steady_clock::now();
+    if (clEnqueueNDRangeKernel(cmd_queue.get(), kernel.get(), 3, nullptr,
+                               global, local, 0, nullptr, nullptr) ||
+        clFinish(cmd_queue.get())) {
+      // e.g. the work-group is too large for the kernel on the device
+      return std::numeric_limits<double>::infinity();
+    }
+    auto end = std::chrono::steady_clock::now();
+    if (!i) continue;
+    times.push_back(
+        std::chrono::duration<double, std::nano>(end - begin).count());
+  }
+  auto mid = times.begin() + times.size() / 2;
+  std::nth_element(times.begin(), mid, times.end());
+  return *mid;
+}
+
+}  // namespace
+
+int main(int argc, const char *argv[]) {
+#define BENCH_EXPANDER(type, id, in_size, out_size, weight_size,      \
+                       bias_size, g0, g1, g2, l0, l1, l2)             \
+  do {                                                                \
+    size_t global[3] = {g0, g1, g2}, local[3] = {l0, l1, l2};         \
+    std::cout << #id << ' '                                           \
+              << Measure(type(id), in_size, out_size, weight_size,    \
+                         bias_size, global, local)                    \
+              << std::endl;                                           \
+  } while (0);
+
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " PLAT_ID DEV_DESC" << std::endl;
+    return 1;
+  }
+  InitDevice(std::strtoul(argv[1], nullptr, 10), argv[2]);
+  InitContext();
+  LoadProgram();
+  // identity of the device comes first
+  std::cout << "device " << GetDeviceIdentity() << std::endl;
+  BENCH_VARIANTS(BENCH_EXPANDER);
+  return 0;
+
+#undef BENCH_EXPANDER
+}
+
+#undef BENCH_VARIANTS
+#undef BENCH_REPEATS
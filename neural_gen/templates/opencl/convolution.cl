@@ -1,26 +1,221 @@
+#ifdef RAW_INPUT
+#define CONV_INPUT(x, y, c) READ_RAW_INPUT(raw, x, y, c)
+#else
+#define CONV_INPUT(x, y, c) \
+  in[GetIndex(x, y, c, INPUT_WIDTH, INPUT_HEIGHT)]
+#endif  // RAW_INPUT
+
+// grouped convolution, output channels only convolve input channels of
+// their groups
+#ifndef GROUPS
+#define GROUPS 1
+#endif
+#define GROUP_INPUT_DEPTH (INPUT_DEPTH / GROUPS)
+#define GROUP_OUTPUT_DEPTH (OUTPUT_DEPTH / GROUPS)
+
+// the first input channel of the group of an output channel
+#if GROUPS == 1
+#define GROUP_FIRST_INPUT(channel) 0
+#else
+#define GROUP_FIRST_INPUT(channel) \
+  ((channel) / GROUP_OUTPUT_DEPTH * GROUP_INPUT_DEPTH)
+#endif
+
+#ifdef FUSED
+#define OUTPUT_ELEMS (OUTPUT_WIDTH * OUTPUT_HEIGHT * OUTPUT_DEPTH)
+
+DECL_LAYER(CONV_3D, LAYER_ID) {
+  // work-items of the group loop over outputs of all its inputs
+  for (size_t j = get_local_id(0); j < FUSED_IMAGES * OUTPUT_ELEMS;
+       j += get_local_size(0)) {
+    size_t batch = j / OUTPUT_ELEMS, index = j % OUTPUT_ELEMS;
+    size_t channel = index / (OUTPUT_WIDTH * OUTPUT_HEIGHT);
+    size_t y = index / OUTPUT_WIDTH % OUTPUT_HEIGHT;
+    size_t x = index % OUTPUT_WIDTH;
+#ifdef RAW_INPUT
+    global const RAW_INPUT_TYPE *raw = RAW_INPUT_PTR(batch);
+    size_t base_c = GROUP_FIRST_INPUT(channel);
+#else
+    // channels of all inputs are contiguous
+    size_t base_c = batch * INPUT_DEPTH + GROUP_FIRST_INPUT(channel);
+#endif  // RAW_INPUT
+    float cur = 0.0;
+    // perform convolution
+    for (size_t inc = 0; inc < GROUP_INPUT_DEPTH; ++inc) {
+      global const float *pw =
+          weight + GetIndex(0, 0, GROUP_INPUT_DEPTH * channel + inc,
+                            KERNEL_WIDTH, KERNEL_HEIGHT);
+      float sum = 0.0;
+      for (size_t wy = 0; wy < KERNEL_HEIGHT; wy++) {
+        for (size_t wx = 0; wx < KERNEL_WIDTH; wx++) {
+          sum += *pw++ * CONV_INPUT(x + wx, y + wy, base_c + inc);
+        }
+      }
+      cur += sum;
+    }
+    // add bias and perform activation
+    out[j] = ACT_FUNC(ACTIVATION)(cur + bias[channel]);
+  }
+}
+
+#undef OUTPUT_ELEMS
+#elif defined(DEPTHWISE_3X3)
+DECL_LAYER(CONV_3D, LAYER_ID) {
+  size_t batch = get_global_id(0) / OUTPUT_DEPTH;
+  size_t channel = get_global_id(0) % OUTPUT_DEPTH;
+  size_t y = get_global_id(1);
+  // each work-item computes 4 adjacent outputs of a channel
+  size_t x = get_global_id(2) * 4;
+  if (y >= OUTPUT_HEIGHT || x >= OUTPUT_WIDTH) return;
+  // each output channel convolves its own input channel
+  in += ((batch * INPUT_DEPTH + channel) * INPUT_HEIGHT + y) * INPUT_WIDTH +
+        x;
+  out += ((batch * OUTPUT_DEPTH + channel) * OUTPUT_HEIGHT + y) *
+             OUTPUT_WIDTH +
+         x;
+  weight += channel * 9;
+  if (x + 4 <= OUTPUT_WIDTH) {
+    float4 sum = (float4)(0.0f);
+    for (size_t wy = 0; wy < 3; wy++) {
+      for (size_t wx = 0; wx < 3; wx++) {
+        sum += weight[wy * 3 + wx] * vload4(0, in + wy * INPUT_WIDTH + wx);
+      }
+    }
+    // add bias and perform activation
+    float res[4] = {sum.x, sum.y, sum.z, sum.w};
+    for (size_t k = 0; k < 4; ++k) {
+      out[k] = ACT_FUNC(ACTIVATION)(res[k] + bias[channel]);
+    }
+  }
+  else {
+    // the last outputs of the row
+    for (size_t k = 0; x + k < OUTPUT_WIDTH; ++k) {
+      float cur = 0.0;
+      for (size_t wy = 0; wy < 3; wy++) {
+        for (size_t wx = 0; wx < 3; wx++) {
+          cur += weight[wy * 3 + wx] * in[wy * INPUT_WIDTH + k + wx];
+        }
+      }
+      out[k] = ACT_FUNC(ACTIVATION)(cur + bias[channel]);
+    }
+  }
+}
+#elif defined(OPT)
+#define KERNEL_SIZE (KERNEL_WIDTH * KERNEL_HEIGHT)
+#define TILE_IN_WIDTH (TILE_WIDTH + KERNEL_WIDTH - 1)
+#define TILE_IN_HEIGHT (TILE_HEIGHT + KERNEL_HEIGHT - 1)
+#define GROUP_CHANNELS (LOCAL_CHANNELS * CHANNEL_BLOCK)
+#define GROUP_SIZE (LOCAL_CHANNELS * TILE_HEIGHT * TILE_WIDTH)
+#define CHANNEL_GROUPS \
+  ((OUTPUT_DEPTH + GROUP_CHANNELS - 1) / GROUP_CHANNELS)
+
+DECL_LAYER(CONV_3D, LAYER_ID) {
+  // input tile (with halo) & filter block in local memory
+  local float in_tile[INPUT_BLOCK][TILE_IN_HEIGHT][TILE_IN_WIDTH];
+  local float w_tile[GROUP_CHANNELS][INPUT_BLOCK][KERNEL_SIZE];
+  size_t lc = get_local_id(0), ly = get_local_id(1), lx = get_local_id(2);
+  size_t lid = (lc * TILE_HEIGHT + ly) * TILE_WIDTH + lx;
+  size_t batch = get_group_id(0) / CHANNEL_GROUPS;
+  size_t base_c = get_group_id(0) % CHANNEL_GROUPS * GROUP_CHANNELS;
+  size_t base_y = get_group_id(1) * TILE_HEIGHT;
+  size_t base_x = get_group_id(2) * TILE_WIDTH;
+  // output channels of the group are in the same convolution group
+  size_t base_in = GROUP_FIRST_INPUT(base_c);
+  // each work-item computes `CHANNEL_BLOCK` output channels
+  float cur[CHANNEL_BLOCK];
+  for (size_t k = 0; k < CHANNEL_BLOCK; ++k) cur[k] = 0.0;
+#ifdef RAW_INPUT
+  global const RAW_INPUT_TYPE *raw = RAW_INPUT_PTR(batch);
+#else
+  in += batch * INPUT_WIDTH * INPUT_HEIGHT * INPUT_DEPTH;
+#endif  // RAW_INPUT
+  out += batch * OUTPUT_WIDTH * OUTPUT_HEIGHT * OUTPUT_DEPTH;
+  for (size_t inc = 0; inc < GROUP_INPUT_DEPTH; inc += INPUT_BLOCK) {
+    // stage input tile
+    for (size_t i = lid; i < INPUT_BLOCK * TILE_IN_HEIGHT * TILE_IN_WIDTH;
+         i += GROUP_SIZE) {
+      size_t tx = i % TILE_IN_WIDTH;
+      size_t ty = i / TILE_IN_WIDTH % TILE_IN_HEIGHT;
+      size_t tc = i / (TILE_IN_WIDTH * TILE_IN_HEIGHT);
+      size_t ix = base_x + tx, iy = base_y + ty;
+      in_tile[tc][ty][tx] = ix < INPUT_WIDTH && iy < INPUT_HEIGHT
+                                ? CONV_INPUT(ix, iy, base_in + inc + tc)
+                                : 0.0;
+    }
+    // stage filter block
+    for (size_t i = lid; i < GROUP_CHANNELS * INPUT_BLOCK * KERNEL_SIZE;
+         i += GROUP_SIZE) {
+      size_t k = i % KERNEL_SIZE, tc = i / KERNEL_SIZE % INPUT_BLOCK;
+      size_t oc = i / (KERNEL_SIZE * INPUT_BLOCK), channel = base_c + oc;
+      w_tile[oc][tc][k] =
+          channel < OUTPUT_DEPTH
+              ? weight[(GROUP_INPUT_DEPTH * channel + inc + tc) *
+                           KERNEL_SIZE +
+                       k]
+              : 0.0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    // perform convolution
+    for (size_t tc = 0; tc < INPUT_BLOCK; ++tc) {
+      for (size_t wy = 0; wy < KERNEL_HEIGHT; wy++) {
+        for (size_t wx = 0; wx < KERNEL_WIDTH; wx++) {
+          float v = in_tile[tc][ly + wy][lx + wx];
+          for (size_t k = 0; k < CHANNEL_BLOCK; ++k) {
+            cur[k] += w_tile[lc + k * LOCAL_CHANNELS][tc]
+                            [wy * KERNEL_WIDTH + wx] * v;
+          }
+        }
+      }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  // add bias and perform activation
+  size_t y = base_y + ly, x = base_x + lx;
+  if (y >= OUTPUT_HEIGHT || x >= OUTPUT_WIDTH) return;
+  for (size_t k = 0; k < CHANNEL_BLOCK; ++k) {
+    size_t channel = base_c + lc + k * LOCAL_CHANNELS;
+    if (channel < OUTPUT_DEPTH) {
+      size_t index =
+          (channel * OUTPUT_HEIGHT * OUTPUT_WIDTH) + y * OUTPUT_WIDTH + x;
+      out[index] = ACT_FUNC(ACTIVATION)(cur[k] + bias[channel]);
+    }
+  }
+}
+
+#undef KERNEL_SIZE
+#undef TILE_IN_WIDTH
+#undef TILE_IN_HEIGHT
+#undef GROUP_CHANNELS
+#undef GROUP_SIZE
+#undef CHANNEL_GROUPS
+#else
 DECL_LAYER(CONV_3D, LAYER_ID) {
-  size_t channel = get_global_id(0);
+  size_t batch = get_global_id(0) / OUTPUT_DEPTH;
+  size_t channel = get_global_id(0) % OUTPUT_DEPTH;
   size_t y = get_global_id(1);
   size_t x = get_global_id(2);
+#ifdef RAW_INPUT
+  global const RAW_INPUT_TYPE *raw = RAW_INPUT_PTR(batch);
+#else
+  in += batch * INPUT_WIDTH * INPUT_HEIGHT * INPUT_DEPTH;
+#endif  // RAW_INPUT
+  out += batch * OUTPUT_WIDTH * OUTPUT_HEIGHT * OUTPUT_DEPTH;
   // current neuron
   size_t index =
       (channel * OUTPUT_HEIGHT * OUTPUT_WIDTH) + y * OUTPUT_WIDTH + x;
   float cur = 0.0;
   // perform convolution
-  for (size_t inc = 0; inc < INPUT_DEPTH; ++inc) {
-    size_t addr1 = GetIndex(0, 0, INPUT_DEPTH * channel + inc, KERNEL_WIDTH,
-                            KERNEL_HEIGHT);
-    size_t addr2 = GetIndex(0, 0, inc, INPUT_WIDTH, INPUT_HEIGHT);
+  for (size_t inc = 0; inc < GROUP_INPUT_DEPTH; ++inc) {
+    size_t addr1 = GetIndex(0, 0, GROUP_INPUT_DEPTH * channel + inc,
+                            KERNEL_WIDTH, KERNEL_HEIGHT);
+    size_t in_channel = GROUP_FIRST_INPUT(channel) + inc;
     float sum = 0.0;
     // kernel
     global const float *pw = weight + addr1;
     global const float *ppw = pw;
-    // input
-    global const float *pi = in + addr2;
-    global const float *ppi = pi + y * INPUT_WIDTH + x;
     for (size_t wy = 0; wy < KERNEL_HEIGHT; wy++) {
       for (size_t wx = 0; wx < KERNEL_WIDTH; wx++) {
-        sum += *ppw++ * ppi[wy * INPUT_WIDTH + wx];
+        sum += *ppw++ * CONV_INPUT(x + wx, y + wy, in_channel);
       }
     }
     cur += sum;
@@ -28,7 +223,9 @@ DECL_LAYER(CONV_3D, LAYER_ID) {
   // add bias and perform activation
   out[index] = ACT_FUNC(ACTIVATION)(cur + bias[channel]);
 }
+#endif  // FUSED
 
+#undef CONV_INPUT
 #undef LAYER_ID
 #undef PADDING_VALID
 #undef STRIDE
@@ -41,3 +238,24 @@ DECL_LAYER(CONV_3D, LAYER_ID) {
 #undef OUTPUT_HEIGHT
 #undef OUTPUT_DEPTH
 #undef ACTIVATION
+#undef RAW_INPUT
+#undef RAW_INPUT_TYPE
+#undef RAW_WIDTH
+#undef RAW_HEIGHT
+#undef RAW_DEPTH
+#undef INPUT_PAD_X
+#undef INPUT_PAD_Y
+#undef INPUT_SCALE
+#undef INPUT_OFFSET
+#undef TILE_WIDTH
+#undef TILE_HEIGHT
+#undef CHANNEL_BLOCK
+#undef LOCAL_CHANNELS
+#undef INPUT_BLOCK
+#undef INPUT_SPACE
+#undef OUTPUT_SPACE
+#undef GROUPS
+#undef GROUP_INPUT_DEPTH
+#undef GROUP_OUTPUT_DEPTH
+#undef GROUP_FIRST_INPUT
+#undef DEPTHWISE_3X3
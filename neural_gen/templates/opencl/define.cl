@@ -1,3 +1,7 @@
+#ifndef BATCH_SIZE
+#define BATCH_SIZE 1
+#endif
+
 #define CONCAT_IMPL(x, y) x##y
 #define CONCAT(x, y) CONCAT_IMPL(x, y)
 
@@ -6,9 +10,43 @@
 #define POOLING(id) CONCAT(Pooling_, id)
 #define FULL_CONN(id) CONCAT(FullConn_, id)
 
+#ifdef FUSED
+// layers are functions called by the fused kernel, inputs & outputs are
+// in global or local memory (`INPUT_SPACE` & `OUTPUT_SPACE`)
+#define DECL_LAYER(type, id)                                        \
+  void type(id)(INPUT_SPACE const float *in, OUTPUT_SPACE float *out, \
+                global const float *weight, global const float *bias)
+#else
 #define DECL_LAYER(type, id)                                \
   kernel void type(id)(global float *in, global float *out, \
                        global float *weight, global float *bias)
+#endif  // FUSED
+
+// shape of the padded raw input of the first layer
+#define RAW_PADDED_WIDTH (RAW_WIDTH + 2 * INPUT_PAD_X)
+#define RAW_PADDED_HEIGHT (RAW_HEIGHT + 2 * INPUT_PAD_Y)
+#define RAW_SIZE (RAW_WIDTH * RAW_HEIGHT * RAW_DEPTH)
+
+// pointer to the raw input of the specific batch
+#define RAW_INPUT_PTR(batch) \
+  ((global const RAW_INPUT_TYPE *)in + (batch)*RAW_SIZE)
+
+// read element (x, y, channel) of the padded raw input and apply the
+// affine transform, padding elements are read as raw zeros
+#define READ_RAW_INPUT(raw, x, y, channel)                                \
+  (((size_t)(x)-INPUT_PAD_X < RAW_WIDTH &&                                \
+            (size_t)(y)-INPUT_PAD_Y < RAW_HEIGHT                          \
+        ? (float)(raw)[GetIndex((x)-INPUT_PAD_X, (y)-INPUT_PAD_Y,         \
+                                channel, RAW_WIDTH, RAW_HEIGHT)]          \
+        : 0.0f) *                                                         \
+       INPUT_SCALE +                                                      \
+   INPUT_OFFSET)
+
+// read the i-th element of the padded raw input
+#define READ_RAW_INDEX(raw, i)                                   \
+  READ_RAW_INPUT(raw, (i) % RAW_PADDED_WIDTH,                    \
+                 (i) / RAW_PADDED_WIDTH % RAW_PADDED_HEIGHT,     \
+                 (i) / (RAW_PADDED_WIDTH * RAW_PADDED_HEIGHT))
 
 inline size_t GetIndex(size_t x, size_t y, size_t channel, size_t width,
                        size_t height) {
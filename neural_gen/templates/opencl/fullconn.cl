@@ -1,14 +1,137 @@
+#ifdef RAW_INPUT
+#define FC_INPUT(batch, i) READ_RAW_INDEX(RAW_INPUT_PTR(batch), i)
+#else
+#define FC_INPUT(batch, i) in[(batch)*INPUT_SIZE + (i)]
+#endif  // RAW_INPUT
+
+#ifdef FUSED
+DECL_LAYER(FULL_CONN, LAYER_ID) {
+  // work-items of the group loop over outputs of all its inputs
+  for (size_t j = get_local_id(0); j < FUSED_IMAGES * OUTPUT_SIZE;
+       j += get_local_size(0)) {
+    size_t batch = j / OUTPUT_SIZE, i = j % OUTPUT_SIZE;
+    float cur = 0.0;
+    for (size_t c = 0; c < INPUT_SIZE; c++) {
+      cur += weight[c * OUTPUT_SIZE + i] * FC_INPUT(batch, c);
+    }
+    out[j] = ACT_FUNC(ACTIVATION)(cur + bias[i]);
+  }
+}
+#elif defined(OPT)
+#if BATCH_SIZE > 1
+#define TILE_OUTPUT (OUTPUT_GROUP * 4)
+#define GROUP_SIZE (OUTPUT_GROUP * BATCH_GROUP)
+
+DECL_LAYER(FULL_CONN, LAYER_ID) {
+  // tile of inputs & weights in local memory
+  local float in_tile[BATCH_GROUP][TILE_DEPTH];
+  local float w_tile[TILE_DEPTH][TILE_OUTPUT];
+  size_t lo = get_local_id(0), lb = get_local_id(1);
+  size_t lid = lb * OUTPUT_GROUP + lo;
+  size_t base_i = get_group_id(0) * TILE_OUTPUT;
+  size_t base_b = get_group_id(1) * BATCH_GROUP;
+  // each work-item computes 4 outputs of one input
+  float4 sum = (float4)(0.0f);
+  for (size_t c = 0; c < INPUT_SIZE; c += TILE_DEPTH) {
+    // stage inputs
+    for (size_t j = lid; j < BATCH_GROUP * TILE_DEPTH; j += GROUP_SIZE) {
+      size_t b = base_b + j / TILE_DEPTH, tc = c + j % TILE_DEPTH;
+      in_tile[j / TILE_DEPTH][j % TILE_DEPTH] =
+          b < BATCH_SIZE && tc < INPUT_SIZE ? FC_INPUT(b, tc) : 0.0;
+    }
+    // stage weights
+    for (size_t j = lid; j < TILE_DEPTH * TILE_OUTPUT; j += GROUP_SIZE) {
+      size_t tc = c + j / TILE_OUTPUT, i = base_i + j % TILE_OUTPUT;
+      w_tile[j / TILE_OUTPUT][j % TILE_OUTPUT] =
+          tc < INPUT_SIZE && i < OUTPUT_SIZE ? weight[tc * OUTPUT_SIZE + i]
+                                             : 0.0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (size_t k = 0; k < TILE_DEPTH; ++k) {
+      sum += vload4(lo, w_tile[k]) * in_tile[lb][k];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  // add bias and perform activation
+  size_t b = base_b + lb, i = base_i + lo * 4;
+  float res[4] = {sum.x, sum.y, sum.z, sum.w};
+  if (b >= BATCH_SIZE) return;
+  for (size_t k = 0; k < 4 && i + k < OUTPUT_SIZE; ++k) {
+    out[b * OUTPUT_SIZE + i + k] =
+        ACT_FUNC(ACTIVATION)(res[k] + bias[i + k]);
+  }
+}
+
+#undef TILE_OUTPUT
+#undef GROUP_SIZE
+#else
+DECL_LAYER(FULL_CONN, LAYER_ID) {
+  // partial sums in local memory
+  local float4 partial[REDUCE_SIZE][OUTPUT_GROUP];
+  size_t lo = get_local_id(0), r = get_local_id(1);
+  size_t i = get_global_id(0) * 4;
+  // each work-item computes 4 outputs of a slice of inputs
+  float4 sum = (float4)(0.0f);
+  if (i + 4 <= OUTPUT_SIZE) {
+    for (size_t c = r; c < INPUT_SIZE; c += REDUCE_SIZE) {
+      sum += vload4(0, weight + c * OUTPUT_SIZE + i) * FC_INPUT(0, c);
+    }
+  }
+  else if (i < OUTPUT_SIZE) {
+    for (size_t c = r; c < INPUT_SIZE; c += REDUCE_SIZE) {
+      global const float *pw = weight + c * OUTPUT_SIZE + i;
+      float v = FC_INPUT(0, c);
+      sum.x += pw[0] * v;
+      if (i + 1 < OUTPUT_SIZE) sum.y += pw[1] * v;
+      if (i + 2 < OUTPUT_SIZE) sum.z += pw[2] * v;
+    }
+  }
+  partial[r][lo] = sum;
+  // tree reduction
+  for (size_t s = REDUCE_SIZE / 2; s > 0; s >>= 1) {
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (r < s) partial[r][lo] += partial[r + s][lo];
+  }
+  // add bias and perform activation
+  if (r) return;
+  sum = partial[0][lo];
+  float res[4] = {sum.x, sum.y, sum.z, sum.w};
+  for (size_t k = 0; k < 4 && i + k < OUTPUT_SIZE; ++k) {
+    out[i + k] = ACT_FUNC(ACTIVATION)(res[k] + bias[i + k]);
+  }
+}
+#endif  // BATCH_SIZE > 1
+#else
 DECL_LAYER(FULL_CONN, LAYER_ID) {
-  size_t i = get_global_id(0);
+  size_t batch = get_global_id(0) / OUTPUT_SIZE;
+  size_t i = get_global_id(0) % OUTPUT_SIZE;
+  out += batch * OUTPUT_SIZE;
   out[i] = 0.0;
   for (size_t c = 0; c < INPUT_SIZE; c++) {
-    out[i] += weight[c * OUTPUT_SIZE + i] * in[c];
+    out[i] += weight[c * OUTPUT_SIZE + i] * FC_INPUT(batch, c);
   }
   out[i] += bias[i];
   out[i] = ACT_FUNC(ACTIVATION)(out[i]);
 }
+#endif  // FUSED
 
+#undef FC_INPUT
 #undef LAYER_ID
 #undef INPUT_SIZE
 #undef OUTPUT_SIZE
 #undef ACTIVATION
+#undef OUTPUT_GROUP
+#undef REDUCE_SIZE
+#undef BATCH_GROUP
+#undef TILE_DEPTH
+#undef RAW_INPUT
+#undef RAW_INPUT_TYPE
+#undef RAW_WIDTH
+#undef RAW_HEIGHT
+#undef RAW_DEPTH
+#undef INPUT_PAD_X
+#undef INPUT_PAD_Y
+#undef INPUT_SCALE
+#undef INPUT_OFFSET
+#undef INPUT_SPACE
+#undef OUTPUT_SPACE
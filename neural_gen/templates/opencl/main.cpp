@@ -2,15 +2,29 @@
 const char *kOpenCLOptions = "";
 const char *kOpenCLProgram = "";
 #define NETWORK_LAYERS(e) e(CONV_3D, 0, 28, 28, 6) e(FULL_CONN, 1, 10, 1, 1)
+#define NETWORK_WORK_SIZES(e) e(0, 2, 28, 28, 1, 14, 14)
+#define HOST_LAYERS(e)
+#define INPUT_TYPE float
+#define INPUT_SIZE 1024
 #define OUTPUT_SIZE 10
+#define BATCH_SIZE 1
 #endif  // GENERATED
 
+#include <algorithm>
+#include <cctype>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <cstdlib>
 #include <fstream>
 #include <functional>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <numeric>
 #include <stdexcept>
 #include <string>
 #include <string_view>
@@ -19,12 +33,49 @@ const char *kOpenCLProgram = "";
 #include <utility>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 #ifdef __APPLE__
 #include <OpenCL/opencl.h>
 #else
 #include <CL/cl.h>
 #endif
 
+#ifdef NGEN_LIBRARY
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+
+#include "ngen.h"
+#endif  // NGEN_LIBRARY
+
+namespace {
+
+// function of a layer running on host, compiled from C++ templates
+using HostLayerFn = void (*)(const float *, float *, const float *,
+                             const float *);
+
+// functions of layers placed on host, other layers run on devices
+const std::unordered_map<size_t, HostLayerFn> kHostLayers = {
+#define HOST_LAYER_EXPANDER(type, id) {id, type(id)},
+    HOST_LAYERS(HOST_LAYER_EXPANDER)
+#undef HOST_LAYER_EXPANDER
+};
+
+}  // namespace
+
+#ifdef HETERO
+// names of layers are redefined as names of kernels
+#undef CONCAT_IMPL
+#undef CONCAT
+#undef CONV_3D
+#undef POOLING
+#undef FULL_CONN
+#endif  // HETERO
+
 #define CONCAT_IMPL(x, y) #x #y
 #define CONCAT(x, y) CONCAT_IMPL(x, y)
 
@@ -34,6 +85,9 @@ const char *kOpenCLProgram = "";
 
 namespace {
 
+// pointer to OpenCL device
+using DevicePtr = std::unique_ptr<std::remove_pointer_t<cl_device_id>,
+                                  decltype(&clReleaseDevice)>;
 // pointer to OpenCL context
 using ContextPtr = std::unique_ptr<std::remove_pointer_t<cl_context>,
                                    decltype(&clReleaseContext)>;
@@ -49,6 +103,9 @@ using KernelPtr = std::unique_ptr<std::remove_pointer_t<cl_kernel>,
 // pointer to OpenCL buffer
 using BufferPtr = std::unique_ptr<std::remove_pointer_t<cl_mem>,
                                   decltype(&clReleaseMemObject)>;
+// pointer to OpenCL event
+using EventPtr = std::unique_ptr<std::remove_pointer_t<cl_event>,
+                                 decltype(&clReleaseEvent)>;
 
 /*
   Model File Format (field: bytes):
@@ -61,11 +118,16 @@ using BufferPtr = std::unique_ptr<std::remove_pointer_t<cl_mem>,
   LAYERn_BIAS_DATA:   LAYERn_BIAS_SIZE * sizeof(float)
 */
 
-// pointer to float array
-using FloatArr = std::unique_ptr<float[]>;
+// pointer to float array, which may be owned, or mapped from an OpenCL
+// buffer and unmapped on release
+using FloatArr = std::unique_ptr<float[], std::function<void(float *)>>;
 
-// float vector
-using FloatVec = std::vector<float>;
+// input vector, elements may be raw data
+using InputVec = std::vector<INPUT_TYPE>;
+
+// pointer to aligned host memory
+template <typename T>
+using HostArr = std::unique_ptr<T[], decltype(&std::free)>;
 
 // model data (vector of (weight, bias) pairs)
 using ModelData = std::vector<std::pair<BufferPtr, BufferPtr>>;
@@ -73,6 +135,10 @@ using ModelData = std::vector<std::pair<BufferPtr, BufferPtr>>;
 // magic number: 1 go ge cal => yi gou ji calc => yi gou ji suan
 constexpr uint32_t kModFileMagicNum = 0x1909eca1;
 
+// alignment of host memory, which is required by some implementations
+// to use host memory directly without copying
+constexpr size_t kHostMemAlign = 4096;
+
 struct ModelFileHeader {
   uint32_t magic;
   uint32_t layer_num;
@@ -83,21 +149,133 @@ struct ModelLayerHeader {
   uint32_t bias_size;
 };
 
-// OpenCL devices
+// global & local work size of kernel
+struct WorkSize {
+  size_t global[3];
+  size_t local[3];
+};
+
+// batch of inputs, uploaded asynchronously
+struct InputBatch {
+  HostArr<INPUT_TYPE> data = {nullptr, std::free};
+  BufferPtr buffer = {nullptr, nullptr};
+  EventPtr uploaded = {nullptr, nullptr};
+  size_t index = 0;
+  size_t first = 0;
+  size_t count = 0;
+};
+
+// executor of network on an OpenCL device
+struct Executor {
+  cl_device_id device;
+  // command queues for running kernels & uploading inputs
+  CmdQueuePtr cmd_queue = {nullptr, nullptr};
+  CmdQueuePtr upload_queue = {nullptr, nullptr};
+  // kernels of all layers
+  std::unordered_map<size_t, KernelPtr> kernels;
+  // replica of model data
+  ModelData model;
+  // double-buffered input batches
+  InputBatch batches[2];
+};
+
+// activations of a batch, in a device buffer, or in host memory if the
+// layer producing them runs on host
+struct Activations {
+  BufferPtr buffer = {nullptr, nullptr};
+  FloatArr host;
+};
+
+#ifdef OPT
+// work sizes of layers with tiled kernels
+const std::unordered_map<size_t, WorkSize> kWorkSizes = {
+#define WORK_SIZE_EXPANDER(id, g0, g1, g2, l0, l1, l2) \
+  {id, {{g0, g1, g2}, {l0, l1, l2}}},
+    NETWORK_WORK_SIZES(WORK_SIZE_EXPANDER)
+#undef WORK_SIZE_EXPANDER
+};
+#endif  // OPT
+
+#ifdef FUSED
+// key of the fused kernel in kernels of executors, the input layer (ID 0)
+// has no kernel
+constexpr size_t kFusedKernelId = 0;
+#endif  // FUSED
+
+// the selected OpenCL devices
 std::vector<cl_device_id> devices;
-// the selected OpenCL device
-cl_device_id device;
+// sub-devices created by partitioning
+std::vector<DevicePtr> sub_devices;
+// whether all devices share physical memory with host, buffers will use
+// host memory directly (zero-copy) if so
+bool zero_copy;
+// host memory of model data, shared by all devices in zero-copy mode
+std::vector<HostArr<float>> host_model;
+// weights & biases of layers running on host, shared by all executors
+std::unordered_map<size_t, std::pair<HostArr<float>, HostArr<float>>>
+    host_params;
 // OpenCL context
 ContextPtr context = {nullptr, nullptr};
-// OpenCL command queue
-CmdQueuePtr cmd_queue = {nullptr, nullptr};
 // OpenCL program
 ProgramPtr program = {nullptr, nullptr};
-// OpenCL kernels of all layers
-std::unordered_map<size_t, KernelPtr> kernels;
+// executors on all selected devices
+std::vector<Executor> executors;
+
+#ifdef NGEN_LIBRARY
+// inputs & outputs of the current inference, owned by library users
+const INPUT_TYPE *input_data;
+float *output_data;
+#else
+// input files
+const char **input_files;
+#endif  // NGEN_LIBRARY
+size_t input_num;
+// mutex for dispatching inputs & collecting outputs
+std::mutex batch_mutex;
+// index of the next input, and the next batch
+size_t next_input, next_batch;
+#ifndef NGEN_LIBRARY
+// outputs that are not dumped yet, and index of the next batch to dump
+std::map<size_t, std::pair<FloatArr, size_t>> pending_outputs;
+size_t next_dump;
+#endif  // NGEN_LIBRARY
+
+// partition the specific device into sub-devices
+void PartitionDevice(cl_device_id device, cl_uint units) {
+  cl_device_partition_property props[] = {CL_DEVICE_PARTITION_EQUALLY,
+                                          units, 0};
+  cl_uint sub_num;
+  if (clCreateSubDevices(device, props, 0, nullptr, &sub_num)) {
+    throw std::runtime_error("failed to partition device");
+  }
+  std::vector<cl_device_id> subs(sub_num);
+  if (clCreateSubDevices(device, props, sub_num, subs.data(), nullptr)) {
+    throw std::runtime_error("failed to partition device");
+  }
+  for (const auto &sub : subs) {
+    sub_devices.push_back(DevicePtr(sub, clReleaseDevice));
+    devices.push_back(sub);
+  }
+}
+
+// parse a number in device descriptor
+cl_uint ParseDeviceNumber(std::string_view str) {
+  std::string num(str);
+  char *end;
+  auto value = std::strtoul(num.c_str(), &end, 10);
+  if (num.empty() || !std::isdigit(static_cast<unsigned char>(num[0])) ||
+      *end || value > std::numeric_limits<cl_uint>::max()) {
+    throw std::runtime_error("invalid device configuration");
+  }
+  return value;
+}
 
-// initialize OpenCL device
-void InitDevice(size_t platform_id, size_t device_id) {
+// initialize OpenCL devices, device descriptor can be:
+//   N:                   the N-th device of the platform
+//   all/cpu/gpu/acc:     all devices (of the specific type)
+//   <above>/UNITS:       partition devices into sub-devices with
+//                        UNITS compute units each
+void InitDevice(size_t platform_id, std::string_view dev_desc) {
   // initialize platform info
   cl_uint plat_num;
   if (clGetPlatformIDs(0, nullptr, &plat_num) || plat_num <= platform_id) {
@@ -108,19 +286,55 @@ void InitDevice(size_t platform_id, size_t device_id) {
   if (clGetPlatformIDs(plat_num, plats.data(), nullptr)) {
     throw std::runtime_error("failed to read platform ids");
   }
+  // parse device descriptor
+  auto pos = dev_desc.find('/');
+  auto type_desc = dev_desc.substr(0, pos);
+  cl_uint units = 0;
+  if (pos != std::string_view::npos) {
+    units = ParseDeviceNumber(dev_desc.substr(pos + 1));
+  }
+  const std::unordered_map<std::string_view, cl_device_type> kTypes = {
+      {"all", CL_DEVICE_TYPE_ALL},
+      {"cpu", CL_DEVICE_TYPE_CPU},
+      {"gpu", CL_DEVICE_TYPE_GPU},
+      {"acc", CL_DEVICE_TYPE_ACCELERATOR},
+  };
+  auto type = kTypes.find(type_desc);
+  auto dev_type = type != kTypes.end() ? type->second : CL_DEVICE_TYPE_ALL;
   // initialize device
   cl_uint dev_num;
-  if (clGetDeviceIDs(plats[platform_id], CL_DEVICE_TYPE_ALL, 0, nullptr,
-                     &dev_num) ||
-      dev_num <= device_id) {
+  if (clGetDeviceIDs(plats[platform_id], dev_type, 0, nullptr, &dev_num) ||
+      !dev_num) {
     throw std::runtime_error("invalid device configuration");
   }
-  devices.resize(dev_num);
-  if (clGetDeviceIDs(plats[platform_id], CL_DEVICE_TYPE_ALL, dev_num,
-                     devices.data(), nullptr)) {
+  std::vector<cl_device_id> plat_devs(dev_num);
+  if (clGetDeviceIDs(plats[platform_id], dev_type, dev_num,
+                     plat_devs.data(), nullptr)) {
     throw std::runtime_error("failed to read device ids");
   }
-  device = devices[device_id];
+  if (type == kTypes.end()) {
+    auto device_id = ParseDeviceNumber(type_desc);
+    if (dev_num <= device_id) {
+      throw std::runtime_error("invalid device configuration");
+    }
+    plat_devs = {plat_devs[device_id]};
+  }
+  // select devices
+  for (const auto &device : plat_devs) {
+    if (units) {
+      PartitionDevice(device, units);
+    }
+    else {
+      devices.push_back(device);
+    }
+  }
+  // check if all devices share memory with host
+  zero_copy = std::all_of(devices.begin(), devices.end(), [](auto device) {
+    cl_bool unified;
+    return !clGetDeviceInfo(device, CL_DEVICE_HOST_UNIFIED_MEMORY,
+                            sizeof(cl_bool), &unified, nullptr) &&
+           unified;
+  });
 }
 
 // initialize context & command queue
@@ -130,13 +344,22 @@ void InitContext() {
   context =
       ContextPtr(clCreateContext(nullptr, devices.size(), devices.data(),
                                  nullptr, nullptr, &err),
-                 clRetainContext);
+                 clReleaseContext);
   if (err) throw std::runtime_error("failed to create context");
-  // initialize command queue
-  cmd_queue =
-      CmdQueuePtr(clCreateCommandQueue(context.get(), device, 0, &err),
-                  clReleaseCommandQueue);
-  if (err) throw std::runtime_error("failed to create command queue");
+  // initialize command queues of all executors
+  executors.resize(devices.size());
+  for (size_t i = 0; i < devices.size(); ++i) {
+    auto &exec = executors[i];
+    exec.device = devices[i];
+    exec.cmd_queue = CmdQueuePtr(
+        clCreateCommandQueue(context.get(), exec.device, 0, &err),
+        clReleaseCommandQueue);
+    if (err) throw std::runtime_error("failed to create command queue");
+    exec.upload_queue = CmdQueuePtr(
+        clCreateCommandQueue(context.get(), exec.device, 0, &err),
+        clReleaseCommandQueue);
+    if (err) throw std::runtime_error("failed to create command queue");
+  }
 }
 
 // load OpenCL program
@@ -153,11 +376,11 @@ void LoadProgram() {
                      kOpenCLOptions, nullptr, nullptr)) {
     // read compile log
     size_t log_size;
-    clGetProgramBuildInfo(program.get(), device, CL_PROGRAM_BUILD_LOG, 0,
-                          nullptr, &log_size);
+    clGetProgramBuildInfo(program.get(), devices[0], CL_PROGRAM_BUILD_LOG,
+                          0, nullptr, &log_size);
     std::string comp_log;
     comp_log.resize(log_size);
-    clGetProgramBuildInfo(program.get(), device, CL_PROGRAM_BUILD_LOG,
+    clGetProgramBuildInfo(program.get(), devices[0], CL_PROGRAM_BUILD_LOG,
                           log_size, comp_log.data(), nullptr);
     throw std::runtime_error("failed to build program\n" + comp_log);
   }
@@ -165,8 +388,20 @@ void LoadProgram() {
 
 // initialize kernels of all layers
 void InitKernels() {
+#ifdef FUSED
+  // all layers run in a single kernel
+  for (auto &exec : executors) {
+    cl_int err;
+    exec.kernels.insert(
+        {kFusedKernelId,
+         KernelPtr(clCreateKernel(program.get(), "Network", &err),
+                   clReleaseKernel)});
+    if (err) throw std::runtime_error("failed to create kernel");
+  }
+#else
 #define NETWORK_EXPANDER(type, id, width, height, depth)              \
   do {                                                                \
+    if (kHostLayers.count(id)) break;                                 \
     cl_int err;                                                       \
     kernels.insert(                                                   \
         {id, KernelPtr(clCreateKernel(program.get(), type(id), &err), \
@@ -174,29 +409,225 @@ void InitKernels() {
     if (err) throw std::runtime_error("failed to create kernel");     \
   } while (0);
 
-  NETWORK_LAYERS(NETWORK_EXPANDER);
+  for (auto &exec : executors) {
+    auto &kernels = exec.kernels;
+    NETWORK_LAYERS(NETWORK_EXPANDER);
+  }
 
 #undef NETWORK_EXPANDER
+#endif  // FUSED
+}
+
+// allocate aligned host memory for the specific number of elements
+template <typename T>
+HostArr<T> NewHostArr(size_t count) {
+  // size must be a multiple of alignment
+  auto size = (count * sizeof(T) / kHostMemAlign + 1) * kHostMemAlign;
+  auto mem = static_cast<T *>(std::aligned_alloc(kHostMemAlign, size));
+  if (!mem) throw std::runtime_error("failed to allocate host memory");
+  return HostArr<T>(mem, std::free);
 }
 
 // create a new OpenCL buffer
-BufferPtr NewBuffer(size_t size, cl_mem_flags flags) {
+BufferPtr NewBuffer(size_t size, cl_mem_flags flags,
+                    void *host_ptr = nullptr) {
   cl_int err;
   auto buffer =
-      BufferPtr(clCreateBuffer(context.get(), flags, size, nullptr, &err),
+      BufferPtr(clCreateBuffer(context.get(), flags, size, host_ptr, &err),
                 clReleaseMemObject);
   if (err) throw std::runtime_error("failed to create OpenCL buffer");
   return buffer;
 }
 
+// initialize input batches of all executors
+void InitBatches() {
+  for (auto &exec : executors) {
+    for (auto &batch : exec.batches) {
+      batch.data = NewHostArr<INPUT_TYPE>(BATCH_SIZE * INPUT_SIZE);
+#ifndef HOST_INPUT
+      // inputs are not uploaded if the first layer runs on host
+      auto size = BATCH_SIZE * INPUT_SIZE * sizeof(INPUT_TYPE);
+      batch.buffer = NewBuffer(
+          size, CL_MEM_READ_ONLY | (zero_copy ? CL_MEM_USE_HOST_PTR : 0),
+          zero_copy ? batch.data.get() : nullptr);
+#endif  // HOST_INPUT
+    }
+  }
+}
+
 // write data to the specific OpenCL buffer
-void WriteBuffer(const BufferPtr &buffer, void *mem, size_t size) {
-  if (clEnqueueWriteBuffer(cmd_queue.get(), buffer.get(), CL_TRUE, 0, size,
-                           mem, 0, nullptr, nullptr)) {
+void WriteBuffer(const CmdQueuePtr &queue, const BufferPtr &buffer,
+                 void *mem, size_t size) {
+  if (clEnqueueWriteBuffer(queue.get(), buffer.get(), CL_TRUE, 0, size, mem,
+                           0, nullptr, nullptr)) {
     throw std::runtime_error("failed to write OpenCL buffer");
   }
 }
 
+// map the specific OpenCL buffer to host memory, blocking
+template <typename T>
+T *MapBuffer(const CmdQueuePtr &queue, const BufferPtr &buffer,
+             cl_map_flags flags, size_t size) {
+  cl_int err;
+  auto mem = clEnqueueMapBuffer(queue.get(), buffer.get(), CL_TRUE, flags,
+                                0, size, 0, nullptr, nullptr, &err);
+  if (err) throw std::runtime_error("failed to map OpenCL buffer");
+  return static_cast<T *>(mem);
+}
+
+// create a read-only buffer of model data, the buffer uses the host
+// memory directly in zero-copy mode
+BufferPtr NewModelBuffer(const Executor &exec, const HostArr<float> &data,
+                         size_t count) {
+  auto size = count * sizeof(float);
+  if (zero_copy) {
+    return NewBuffer(size, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                     data.get());
+  }
+  auto buffer = NewBuffer(size, CL_MEM_READ_ONLY);
+  WriteBuffer(exec.cmd_queue, buffer, data.get(), size);
+  return buffer;
+}
+
+#ifndef NGEN_LIBRARY
+/*
+  Result File Format (field: bytes):
+
+  MAGIC_NUMBER: 4
+  RECORD_NUM:   4
+  OUTPUT_SIZE:  4
+  TOP_K:        4
+  RECORDn:      OUTPUT_SIZE * sizeof(float), if TOP_K is zero
+                TOP_K * sizeof(TopKEntry), otherwise
+
+  Records are stored in the order of inputs.
+*/
+
+constexpr uint32_t kResFileMagicNum = 0x1909eca2;
+
+struct ResultFileHeader {
+  uint32_t magic;
+  uint32_t record_num;
+  uint32_t output_size;
+  uint32_t top_k;
+};
+
+// entry of top-k records, in descending order of scores
+struct TopKEntry {
+  uint32_t index;
+  float score;
+};
+
+// command line options
+struct Options {
+  // result file, results are dumped as text if empty
+  std::string_view result_file;
+  // number of entries of top-k records, zero for all logits
+  size_t top_k = 0;
+  // dump results as text even if the result file is specified
+  bool text = false;
+};
+
+// mapped result file
+struct ResultFile {
+  char *data = nullptr;
+  size_t size = 0;
+  size_t record_size = 0;
+  size_t top_k = 0;
+};
+
+Options options;
+ResultFile results;
+
+// parse a decimal number at the beginning of the string, returns
+// pointer to the rest of the string, or null if there is no number
+const char *ParseNumber(const char *str, size_t &value) {
+  if (!std::isdigit(static_cast<unsigned char>(*str))) return nullptr;
+  char *end;
+  value = std::strtoul(str, &end, 10);
+  return end;
+}
+
+// parse options, returns index of the first positional argument,
+// or zero if failed
+int ParseOptions(int argc, const char *argv[]) {
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; ++i) {
+    std::string_view opt = argv[i];
+    if (opt == "-t") {
+      options.text = true;
+    }
+    else if (opt == "-o" && i + 1 < argc) {
+      options.result_file = argv[++i];
+    }
+    else if (opt == "-k" && i + 1 < argc) {
+      auto end = ParseNumber(argv[++i], options.top_k);
+      if (!end || *end || options.top_k > OUTPUT_SIZE) return 0;
+    }
+    else {
+      return 0;
+    }
+  }
+  if (options.result_file.empty()) {
+    if (options.top_k) return 0;
+    options.text = true;
+  }
+  return i;
+}
+
+// create the result file for the specific number of records, and map it
+void OpenResultFile(size_t record_num) {
+  results.top_k = options.top_k;
+  results.record_size = results.top_k ? results.top_k * sizeof(TopKEntry)
+                                      : OUTPUT_SIZE * sizeof(float);
+  results.size =
+      sizeof(ResultFileHeader) + record_num * results.record_size;
+  // create & map file
+  auto fd = open(std::string(options.result_file).c_str(),
+                 O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) throw std::runtime_error("Failed to create result file!");
+  auto failed = ftruncate(fd, results.size);
+  auto data = failed ? MAP_FAILED
+                     : mmap(nullptr, results.size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw std::runtime_error("Failed to map result file!");
+  }
+  results.data = static_cast<char *>(data);
+  // write header
+  ResultFileHeader rfh = {kResFileMagicNum,
+                          static_cast<uint32_t>(record_num), OUTPUT_SIZE,
+                          static_cast<uint32_t>(results.top_k)};
+  std::memcpy(results.data, &rfh, sizeof(ResultFileHeader));
+}
+
+// unmap the result file
+void CloseResultFile() {
+  if (results.data) munmap(results.data, results.size);
+}
+
+// write record of the specific input to the result file
+void WriteRecord(size_t index, const float *output) {
+  auto record = results.data + sizeof(ResultFileHeader) +
+                index * results.record_size;
+  if (!results.top_k) {
+    std::memcpy(record, output, results.record_size);
+    return;
+  }
+  // select top-k outputs
+  uint32_t indices[OUTPUT_SIZE];
+  std::iota(indices, indices + OUTPUT_SIZE, 0);
+  std::partial_sort(
+      indices, indices + results.top_k, indices + OUTPUT_SIZE,
+      [output](uint32_t l, uint32_t r) { return output[l] > output[r]; });
+  auto entries = reinterpret_cast<TopKEntry *>(record);
+  for (size_t i = 0; i < results.top_k; ++i) {
+    entries[i] = {indices[i], output[indices[i]]};
+  }
+}
+#endif  // NGEN_LIBRARY
+
 // open file or fail
 void OpenFile(std::ifstream &ifs, std::string_view file) {
   ifs.close();
@@ -207,8 +638,8 @@ void OpenFile(std::ifstream &ifs, std::string_view file) {
   }
 }
 
-// read model from file
-ModelData ReadModel(std::istream &is) {
+// read model from file, and replicate it to all executors
+void ReadModel(std::istream &is) {
   // read file header
   ModelFileHeader mfh;
   is.read(reinterpret_cast<char *>(&mfh), sizeof(ModelFileHeader));
@@ -217,99 +648,242 @@ ModelData ReadModel(std::istream &is) {
   }
   // read layers
   ModelLayerHeader mlh;
-  ModelData model;
   for (size_t i = 0; i < mfh.layer_num; ++i) {
     // read weight & bias
     is.read(reinterpret_cast<char *>(&mlh), sizeof(ModelLayerHeader));
-    auto weight = std::make_unique<float[]>(mlh.weight_size);
-    auto bias = std::make_unique<float[]>(mlh.bias_size);
+    auto weight = NewHostArr<float>(mlh.weight_size);
+    auto bias = NewHostArr<float>(mlh.bias_size);
     is.read(reinterpret_cast<char *>(weight.get()),
             mlh.weight_size * sizeof(float));
     is.read(reinterpret_cast<char *>(bias.get()),
             mlh.bias_size * sizeof(float));
+    // layers running on host use weight & bias in host memory
+    if (kHostLayers.count(i)) {
+      for (auto &exec : executors) {
+        exec.model.push_back(
+            {BufferPtr(nullptr, nullptr), BufferPtr(nullptr, nullptr)});
+      }
+      host_params.emplace(i, std::make_pair(std::move(weight),
+                                            std::move(bias)));
+      continue;
+    }
     // create buffer for weight & bias
-    if (!mlh.weight_size || !mlh.bias_size) {
-      model.push_back(
-          {BufferPtr(nullptr, nullptr), BufferPtr(nullptr, nullptr)});
+    for (auto &exec : executors) {
+      if (!mlh.weight_size || !mlh.bias_size) {
+        exec.model.push_back(
+            {BufferPtr(nullptr, nullptr), BufferPtr(nullptr, nullptr)});
+        continue;
+      }
+      exec.model.push_back({NewModelBuffer(exec, weight, mlh.weight_size),
+                            NewModelBuffer(exec, bias, mlh.bias_size)});
     }
-    else {
-      auto weight_buf =
-          NewBuffer(mlh.weight_size * sizeof(float), CL_MEM_READ_ONLY);
-      auto bias_buf =
-          NewBuffer(mlh.bias_size * sizeof(float), CL_MEM_READ_ONLY);
-      WriteBuffer(weight_buf, weight.get(),
-                  mlh.weight_size * sizeof(float));
-      WriteBuffer(bias_buf, bias.get(), mlh.bias_size * sizeof(float));
-      model.push_back({std::move(weight_buf), std::move(bias_buf)});
+    // keep host memory alive for zero-copy buffers
+    if (zero_copy) {
+      host_model.push_back(std::move(weight));
+      host_model.push_back(std::move(bias));
     }
   }
-  return model;
 }
 
+#ifndef NGEN_LIBRARY
 // read input from file
-FloatVec ReadInput(std::istream &is) {
+InputVec ReadInput(std::istream &is) {
   // read input
-  FloatVec arr;
+  InputVec arr;
   while (!is.fail() && !is.eof()) {
-    float cur;
-    is.read(reinterpret_cast<char *>(&cur), sizeof(float));
+    INPUT_TYPE cur;
+    is.read(reinterpret_cast<char *>(&cur), sizeof(INPUT_TYPE));
     arr.push_back(cur);
   }
   if (is.fail() && !is.eof()) throw std::runtime_error("File error!");
   return arr;
 }
+#endif  // NGEN_LIBRARY
+
+// read the next batch of inputs (from files, or from memory in library
+// mode), and upload it asynchronously
+void ReadBatch(const Executor &exec, InputBatch &batch) {
+  // claim input files
+  size_t first;
+  {
+    std::lock_guard<std::mutex> lock(batch_mutex);
+    first = next_input;
+    batch.index = next_batch++;
+    batch.first = first;
+    batch.count = std::min<size_t>(input_num - first, BATCH_SIZE);
+    next_input += batch.count;
+  }
+  if (!batch.count) return;
+#ifdef HOST_INPUT
+  // the first layer runs on host, inputs are not uploaded
+  auto data = batch.data.get();
+#else
+  // in zero-copy mode, map the buffer and read inputs into it directly
+  auto size = batch.count * INPUT_SIZE * sizeof(INPUT_TYPE);
+  auto data = zero_copy ? MapBuffer<INPUT_TYPE>(
+                              exec.upload_queue, batch.buffer,
+                              CL_MAP_WRITE_INVALIDATE_REGION, size)
+                        : batch.data.get();
+#endif  // HOST_INPUT
+  // read inputs
+#ifdef NGEN_LIBRARY
+  std::copy_n(input_data + first * INPUT_SIZE, batch.count * INPUT_SIZE,
+              data);
+#else
+  std::ifstream ifs;
+  for (size_t i = 0; i < batch.count; ++i) {
+    OpenFile(ifs, input_files[first + i]);
+    auto input = ReadInput(ifs);
+    auto end = std::copy_n(input.begin(),
+                           std::min<size_t>(input.size(), INPUT_SIZE),
+                           data + i * INPUT_SIZE);
+    std::fill(end, data + (i + 1) * INPUT_SIZE, INPUT_TYPE());
+  }
+#endif  // NGEN_LIBRARY
+#ifndef HOST_INPUT
+  // upload (or unmap) on the upload queue without blocking
+  cl_event event;
+  auto ret = zero_copy
+                 ? clEnqueueUnmapMemObject(exec.upload_queue.get(),
+                                           batch.buffer.get(), data, 0,
+                                           nullptr, &event)
+                 : clEnqueueWriteBuffer(exec.upload_queue.get(),
+                                        batch.buffer.get(), CL_FALSE, 0,
+                                        size, data, 0, nullptr, &event);
+  if (ret) throw std::runtime_error("failed to upload input batch");
+  batch.uploaded = EventPtr(event, clReleaseEvent);
+  clFlush(exec.upload_queue.get());
+#endif  // HOST_INPUT
+}
+
+// read the specific number of floats from the OpenCL buffer, blocking,
+// in zero-copy mode the buffer is mapped and read in place, and stays
+// mapped until the returned array is released
+FloatArr DownloadBuffer(const Executor &exec, const BufferPtr &buffer,
+                        size_t count) {
+  auto size = count * sizeof(float);
+  if (zero_copy) {
+    auto mem = MapBuffer<float>(exec.cmd_queue, buffer, CL_MAP_READ, size);
+    // keep the buffer alive until it is unmapped
+    auto queue = exec.cmd_queue.get();
+    auto buf = buffer.get();
+    clRetainMemObject(buf);
+    return FloatArr(mem, [queue, buf](float *mem) {
+      clEnqueueUnmapMemObject(queue, buf, mem, 0, nullptr, nullptr);
+      clReleaseMemObject(buf);
+    });
+  }
+  FloatArr data = std::make_unique<float[]>(count);
+  if (clEnqueueReadBuffer(exec.cmd_queue.get(), buffer.get(), CL_TRUE, 0,
+                          size, data.get(), 0, nullptr, nullptr)) {
+    throw std::runtime_error("failed to read OpenCL buffer");
+  }
+  return data;
+}
+
+#ifndef FUSED
+// run the specific layer on host for all inputs of the batch, inputs are
+// downloaded first if they are on device, `in_size` & `out_size` are
+// numbers of elements per input
+void RunHostLayer(const Executor &exec, const InputBatch &batch, size_t id,
+                  HostLayerFn layer, Activations &acts, size_t in_size,
+                  size_t out_size) {
+  if (acts.buffer) {
+    acts.host = DownloadBuffer(exec, acts.buffer, in_size * BATCH_SIZE);
+    acts.buffer.reset();
+  }
+  // the first layer reads inputs (may be raw data) directly
+  auto in = reinterpret_cast<const char *>(batch.data.get());
+  auto in_stride = INPUT_SIZE * sizeof(INPUT_TYPE);
+  if (acts.host) {
+    in = reinterpret_cast<const char *>(acts.host.get());
+    in_stride = in_size * sizeof(float);
+  }
+  FloatArr out = std::make_unique<float[]>(out_size * BATCH_SIZE);
+  const auto &[weight, bias] = host_params.find(id)->second;
+  for (size_t i = 0; i < batch.count; ++i) {
+    layer(reinterpret_cast<const float *>(in + i * in_stride),
+          out.get() + i * out_size, weight.get(), bias.get());
+  }
+  acts.host = std::move(out);
+}
 
-// infer
-FloatArr Infer(const ModelData &model, FloatVec input) {
+// upload activations in host memory to a new OpenCL buffer, blocking,
+// `count` is the number of floats
+BufferPtr UploadActivations(const Executor &exec, const FloatArr &data,
+                            size_t count) {
+  auto size = count * sizeof(float);
+  auto buffer = NewBuffer(size, CL_MEM_READ_WRITE);
+  WriteBuffer(exec.cmd_queue, buffer, data.get(), size);
+  return buffer;
+}
+#endif  // FUSED
+
+// infer, returns outputs in a device buffer, or in host memory if the
+// last layer runs on host
+Activations Infer(const Executor &exec, const InputBatch &batch) {
 #ifdef OPT
 #define RUN_KERNEL(id, width, height, depth)                              \
   do {                                                                    \
     cl_int ret;                                                           \
     size_t local[3] = {1, 1, 1};                                          \
-    if (width == height) {                                                \
-      for (int i = 10; i > 1; --i) {                                      \
-        if (width % i == 0) {                                             \
-          local[1] = local[2] = i;                                        \
-          break;                                                          \
-        }                                                                 \
-      }                                                                   \
+    size_t global[3] = {depth * BATCH_SIZE, height, width};               \
+    auto it = kWorkSizes.find(id);                                        \
+    if (it != kWorkSizes.end()) {                                         \
+      std::copy(it->second.global, it->second.global + 3, global);        \
+      std::copy(it->second.local, it->second.local + 3, local);           \
     }                                                                     \
-    size_t global[3] = {depth, height, width};                            \
-    if ((ret = clEnqueueNDRangeKernel(cmd_queue.get(), kernel.get(), 3,   \
-                                      nullptr, global, local, 0, nullptr, \
-                                      nullptr))) {                        \
+    if ((ret = clEnqueueNDRangeKernel(cmd_queue, kernel.get(), 3, nullptr, \
+                                      global, local, wait_num,            \
+                                      &wait_event, nullptr))) {           \
       throw std::runtime_error("error when executing kernel " #id         \
                                ", error code: " +                         \
                                std::to_string(ret));                      \
     }                                                                     \
-    clFinish(cmd_queue.get());                                            \
+    wait_num = 0;                                                         \
   } while (0)
 #else
-#define RUN_KERNEL(id, width, height, depth)                            \
-  do {                                                                  \
-    cl_int ret;                                                         \
-    size_t global[3] = {depth, height, width};                          \
-    if ((ret = clEnqueueNDRangeKernel(cmd_queue.get(), kernel.get(), 3, \
-                                      nullptr, global, nullptr, 0,      \
-                                      nullptr, nullptr))) {             \
-      throw std::runtime_error("error when executing kernel " #id       \
-                               ", error code: " +                       \
-                               std::to_string(ret));                    \
-    }                                                                   \
-    clFinish(cmd_queue.get());                                          \
+#define RUN_KERNEL(id, width, height, depth)                              \
+  do {                                                                    \
+    cl_int ret;                                                           \
+    size_t global[3] = {depth * BATCH_SIZE, height, width};               \
+    if ((ret = clEnqueueNDRangeKernel(cmd_queue, kernel.get(), 3, nullptr, \
+                                      global, nullptr, wait_num,          \
+                                      &wait_event, nullptr))) {           \
+      throw std::runtime_error("error when executing kernel " #id         \
+                               ", error code: " +                         \
+                               std::to_string(ret));                      \
+    }                                                                     \
+    wait_num = 0;                                                         \
   } while (0)
 #endif  // OPT
 
 #define NETWORK_EXPANDER(type, id, width, height, depth)                \
   do {                                                                  \
+    size_t out_size = width * height * depth;                           \
+    auto host_layer = kHostLayers.find(id);                             \
+    if (host_layer != kHostLayers.end()) {                              \
+      /* run on host, inputs are downloaded at the boundary */          \
+      RunHostLayer(exec, batch, id, host_layer->second, acts, in_size,  \
+                   out_size);                                           \
+      in_size = out_size;                                               \
+      break;                                                            \
+    }                                                                   \
+    /* upload inputs at the boundary */                                 \
+    if (acts.host) {                                                    \
+      acts.buffer =                                                     \
+          UploadActivations(exec, acts.host, in_size * BATCH_SIZE);     \
+      acts.host.reset();                                                \
+    }                                                                   \
     /* create output buffer */                                          \
-    auto out_buf = NewBuffer(width * height * depth * sizeof(float),    \
-                             CL_MEM_READ_WRITE);                        \
+    auto out_buf =                                                      \
+        NewBuffer(out_size * BATCH_SIZE * sizeof(float), out_flags);    \
     /* get pointer of the current kernel */                             \
-    const auto &kernel = kernels.find(id)->second;                      \
+    const auto &kernel = exec.kernels.find(id)->second;                 \
     /* set kernel arguments */                                          \
-    auto in = buffer.get(), out = out_buf.get();                        \
-    auto weight = model[id].first.get(), bias = model[id].second.get(); \
+    auto in = acts.buffer.get(), out = out_buf.get();                   \
+    auto weight = exec.model[id].first.get();                           \
+    auto bias = exec.model[id].second.get();                            \
     if (clSetKernelArg(kernel.get(), 0, sizeof(cl_mem), &in) ||         \
         clSetKernelArg(kernel.get(), 1, sizeof(cl_mem), &out) ||        \
         clSetKernelArg(kernel.get(), 2, sizeof(cl_mem), &weight) ||     \
@@ -319,39 +893,95 @@ FloatArr Infer(const ModelData &model, FloatVec input) {
     /* run kernel */                                                    \
     RUN_KERNEL(id, width, height, depth);                               \
     /* update for next layer */                                         \
-    buffer = std::move(out_buf);                                        \
-    last_out_size = width * height * depth;                             \
+    acts.buffer = std::move(out_buf);                                   \
+    in_size = out_size;                                                 \
   } while (0);
 
-  size_t last_out_size;
-  // create input buffer
-  auto buffer = NewBuffer(input.size() * sizeof(float), CL_MEM_READ_ONLY);
-  WriteBuffer(buffer, input.data(), input.size() * sizeof(float));
+  auto cmd_queue = exec.cmd_queue.get();
+  // allocate outputs in host accessible memory in zero-copy mode
+  cl_mem_flags out_flags = CL_MEM_READ_WRITE;
+  if (zero_copy) out_flags |= CL_MEM_ALLOC_HOST_PTR;
+  // the first kernel waits for uploading, if inputs are uploaded
+  cl_event wait_event = batch.uploaded.get();
+  cl_uint wait_num = wait_event ? 1 : 0;
   // perform inference
-  NETWORK_LAYERS(NETWORK_EXPANDER);
-  // get output
-  auto output = std::make_unique<float[]>(last_out_size);
-  if (clEnqueueReadBuffer(cmd_queue.get(), buffer.get(), CL_TRUE, 0,
-                          last_out_size * sizeof(float), output.get(), 0,
-                          nullptr, nullptr)) {
-    throw std::runtime_error("failed to read OpenCL buffer");
+  Activations acts;
+  if (batch.buffer) {
+    clRetainMemObject(batch.buffer.get());
+    acts.buffer = BufferPtr(batch.buffer.get(), clReleaseMemObject);
+  }
+#ifdef FUSED
+#define PARAM_EXPANDER(type, id, width, height, depth)                  \
+  do {                                                                  \
+    auto weight = exec.model[id].first.get();                           \
+    auto bias = exec.model[id].second.get();                            \
+    if (clSetKernelArg(kernel.get(), arg++, sizeof(cl_mem), &weight) || \
+        clSetKernelArg(kernel.get(), arg++, sizeof(cl_mem), &bias)) {   \
+      throw std::runtime_error("failed to set argument");               \
+    }                                                                   \
+  } while (0);
+
+  // run all layers in a single launch, each work-group runs all layers
+  // for `FUSED_IMAGES` inputs, no work-group runs padding of the batch
+  auto out_buf =
+      NewBuffer(OUTPUT_SIZE * BATCH_SIZE * sizeof(float), out_flags);
+  const auto &kernel = exec.kernels.find(kFusedKernelId)->second;
+  auto in = acts.buffer.get(), out = out_buf.get();
+  cl_uint arg = 0;
+  if (clSetKernelArg(kernel.get(), arg++, sizeof(cl_mem), &in) ||
+      clSetKernelArg(kernel.get(), arg++, sizeof(cl_mem), &out)) {
+    throw std::runtime_error("failed to set argument");
+  }
+  NETWORK_LAYERS(PARAM_EXPANDER);
+  size_t local = FUSED_GROUP_SIZE;
+  size_t global = (batch.count + FUSED_IMAGES - 1) / FUSED_IMAGES * local;
+  cl_int ret;
+  if ((ret = clEnqueueNDRangeKernel(cmd_queue, kernel.get(), 1, nullptr,
+                                    &global, &local, wait_num, &wait_event,
+                                    nullptr))) {
+    throw std::runtime_error("error when executing fused kernel, "
+                             "error code: " +
+                             std::to_string(ret));
   }
-  return output;
+  acts.buffer = std::move(out_buf);
+
+#undef PARAM_EXPANDER
+#else
+  size_t in_size = INPUT_SIZE;
+  NETWORK_LAYERS(NETWORK_EXPANDER);
+#endif  // FUSED
+  clFlush(cmd_queue);
+  return acts;
 
 #undef NETWORK_EXPANDER
 }
 
+// read outputs of the specific number of inputs from activations
+FloatArr ReadOutput(const Executor &exec, Activations &acts,
+                    size_t count) {
+  if (acts.host) return std::move(acts.host);
+  return DownloadBuffer(exec, acts.buffer, count * OUTPUT_SIZE);
+}
+
+#ifdef NGEN_LIBRARY
+// submit outputs of the specific batch to the output buffer
+void SubmitOutput(const InputBatch &batch, FloatArr output) {
+  // outputs of different batches never overlap, no need to lock
+  std::copy_n(output.get(), batch.count * OUTPUT_SIZE,
+              output_data + batch.first * OUTPUT_SIZE);
+}
+#else
 // dump output to stderr
-void DumpOutput(const FloatArr &output) {
+void DumpOutput(const float *output) {
   for (size_t i = 0; i < OUTPUT_SIZE; ++i) {
     if (i) std::cerr << ' ';
     std::cerr << output[i];
   }
-  std::cerr << std::endl;
+  std::cerr << '\n';
 }
 
 // get the index of the maximum output
-size_t GetMaxIndex(const FloatArr &output) {
+size_t GetMaxIndex(const float *output) {
   float max_elem = -1e9;
   size_t max_i = 0;
   for (size_t i = 0; i < OUTPUT_SIZE; ++i) {
@@ -363,39 +993,331 @@ size_t GetMaxIndex(const FloatArr &output) {
   return max_i;
 }
 
+// submit outputs of the specific batch, write records in place, and dump
+// text outputs in order
+void SubmitOutput(const InputBatch &batch, FloatArr output) {
+  // records of different batches never overlap, no need to lock
+  if (results.data) {
+    for (size_t i = 0; i < batch.count; ++i) {
+      WriteRecord(batch.first + i, output.get() + i * OUTPUT_SIZE);
+    }
+  }
+  if (!options.text) return;
+  std::lock_guard<std::mutex> lock(batch_mutex);
+  pending_outputs.emplace(batch.index,
+                          std::make_pair(std::move(output), batch.count));
+  for (auto it = pending_outputs.begin();
+       it != pending_outputs.end() && it->first == next_dump;
+       it = pending_outputs.erase(it), ++next_dump) {
+    const auto &[out, num] = it->second;
+    for (size_t i = 0; i < num; ++i) {
+      DumpOutput(out.get() + i * OUTPUT_SIZE);
+      std::cout << GetMaxIndex(out.get() + i * OUTPUT_SIZE) << '\n';
+    }
+  }
+}
+#endif  // NGEN_LIBRARY
+
+// run inference on the specific executor until all inputs are consumed
+void RunExecutor(Executor &exec) {
+  auto &batches = exec.batches;
+  ReadBatch(exec, batches[0]);
+  for (size_t cur = 0; batches[cur].count; cur ^= 1) {
+    // infer, and upload the next batch meanwhile
+    auto acts = Infer(exec, batches[cur]);
+    ReadBatch(exec, batches[cur ^ 1]);
+    // get output
+    auto output = ReadOutput(exec, acts, batches[cur].count);
+    SubmitOutput(batches[cur], std::move(output));
+  }
+}
+
+// run all executors until all inputs are consumed, the first one runs on
+// the current thread
+void RunExecutors() {
+  next_input = next_batch = 0;
+  std::vector<std::future<void>> futures;
+  for (size_t i = 1; i < executors.size(); ++i) {
+    futures.push_back(std::async(std::launch::async, RunExecutor,
+                                 std::ref(executors[i])));
+  }
+  RunExecutor(executors[0]);
+  for (auto &future : futures) future.get();
+}
+
+}  // namespace
+
+#ifdef NGEN_LIBRARY
+namespace {
+
+// single-input inference request, queued by the batcher
+struct BatchRequest {
+  const INPUT_TYPE *input;
+  float *output;
+  // time of arrival, a batch is formed before the oldest request in the
+  // queue times out
+  std::chrono::steady_clock::time_point arrival;
+  bool done = false;
+  std::exception_ptr error;
+};
+
+// batcher of concurrent single-input requests, one of the requesting
+// threads becomes the leader, which collects requests until the batch is
+// full or the oldest request times out, and runs the batch for others
+struct Batcher {
+  // maximum batch size, batching is disabled if less than 2
+  std::atomic<size_t> max_size{0};
+  // maximum time of waiting for a full batch
+  std::chrono::microseconds timeout{0};
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::vector<BatchRequest *> queue;
+  // whether there is a leader forming or running a batch
+  bool leading = false;
+};
+
+}  // namespace
+
+// network loaded by library users, states of OpenCL are global, so only
+// one network can be loaded at a time
+struct ngen_network {
+  Batcher batcher;
+};
+
+namespace {
+
+// the only network, and whether it has been loaded
+ngen_network network;
+bool loaded;
+// mutex for serializing library calls
+std::mutex library_mutex;
+// message of the last error of the current thread
+thread_local std::string last_error;
+
+// run the specific function, returns non-zero and records the error
+// message if any exception was thrown
+template <typename Fn>
+int TryRun(Fn fn) {
+  try {
+    fn();
+    return 0;
+  }
+  catch (const std::exception &e) {
+    last_error = e.what();
+  }
+  catch (...) {
+    last_error = "unknown error";
+  }
+  return -1;
+}
+
+// release all OpenCL related stuffs
+void ReleaseAll() {
+  executors.clear();
+  host_model.clear();
+  host_params.clear();
+  program.reset();
+  context.reset();
+  sub_devices.clear();
+  devices.clear();
+}
+
+// run a batch of requests as contiguous inputs, so that they are
+// dispatched in device batches
+void RunBatch(const std::vector<BatchRequest *> &batch) {
+  std::vector<INPUT_TYPE> inputs(batch.size() * INPUT_SIZE);
+  std::vector<float> outputs(batch.size() * OUTPUT_SIZE);
+  for (size_t i = 0; i < batch.size(); ++i) {
+    std::copy_n(batch[i]->input, INPUT_SIZE,
+                inputs.data() + i * INPUT_SIZE);
+  }
+  {
+    std::lock_guard<std::mutex> lock(library_mutex);
+    if (!loaded) throw std::runtime_error("invalid argument");
+    input_data = inputs.data();
+    output_data = outputs.data();
+    input_num = batch.size();
+    RunExecutors();
+  }
+  for (size_t i = 0; i < batch.size(); ++i) {
+    std::copy_n(outputs.data() + i * OUTPUT_SIZE, OUTPUT_SIZE,
+                batch[i]->output);
+  }
+}
+
+// infer on an input through the batcher of the network
+void InferBatched(const INPUT_TYPE *input, float *output) {
+  auto &batcher = network.batcher;
+  BatchRequest req = {input, output, std::chrono::steady_clock::now()};
+  std::unique_lock<std::mutex> lock(batcher.mutex);
+  batcher.queue.push_back(&req);
+  batcher.cond.notify_all();
+  while (!req.done) {
+    if (batcher.leading) {
+      batcher.cond.wait(lock);
+      continue;
+    }
+    // become the leader, wait for a full batch until the oldest request
+    // times out
+    batcher.leading = true;
+    auto deadline = batcher.queue.front()->arrival + batcher.timeout;
+    batcher.cond.wait_until(lock, deadline, [&batcher] {
+      return batcher.queue.size() >= batcher.max_size;
+    });
+    auto count = std::min(batcher.queue.size(), batcher.max_size.load());
+    count = std::max<size_t>(count, 1);
+    std::vector<BatchRequest *> batch(batcher.queue.begin(),
+                                      batcher.queue.begin() + count);
+    batcher.queue.erase(batcher.queue.begin(),
+                        batcher.queue.begin() + count);
+    // run the batch without holding the lock
+    lock.unlock();
+    std::exception_ptr error;
+    try {
+      RunBatch(batch);
+    }
+    catch (...) {
+      error = std::current_exception();
+    }
+    lock.lock();
+    for (auto r : batch) {
+      r->error = error;
+      r->done = true;
+    }
+    batcher.leading = false;
+    batcher.cond.notify_all();
+  }
+  if (req.error) std::rethrow_exception(req.error);
+}
+
 }  // namespace
 
+int ngen_abi_version(void) { return NGEN_ABI_VERSION; }
+
+ngen_network *ngen_load(const char *model, unsigned platform,
+                        const char *device) {
+  std::lock_guard<std::mutex> lock(library_mutex);
+  if (loaded) {
+    last_error = "network has already been loaded";
+    return nullptr;
+  }
+  auto ret = TryRun([&] {
+    if (!model) throw std::runtime_error("model file is not specified");
+    // initialize OpenCL related stuffs
+    InitDevice(platform, device ? device : "0");
+    InitContext();
+    LoadProgram();
+    InitKernels();
+    InitBatches();
+    // read model data
+    std::ifstream ifs;
+    OpenFile(ifs, model);
+    ReadModel(ifs);
+  });
+  if (ret) {
+    ReleaseAll();
+    return nullptr;
+  }
+  loaded = true;
+  return &network;
+}
+
+size_t ngen_input_size(const ngen_network *net) {
+  return INPUT_SIZE * sizeof(INPUT_TYPE);
+}
+
+size_t ngen_output_size(const ngen_network *net) { return OUTPUT_SIZE; }
+
+int ngen_infer(ngen_network *net, const void *input, float *output) {
+  if (net != &network || network.batcher.max_size < 2) {
+    return ngen_infer_batch(net, input, 1, output);
+  }
+  return TryRun([&] {
+    if (!input || !output) throw std::runtime_error("invalid argument");
+    InferBatched(static_cast<const INPUT_TYPE *>(input), output);
+  });
+}
+
+int ngen_infer_batch(ngen_network *net, const void *inputs, size_t count,
+                     float *outputs) {
+  std::lock_guard<std::mutex> lock(library_mutex);
+  return TryRun([&] {
+    if (net != &network || !loaded || (count && (!inputs || !outputs))) {
+      throw std::runtime_error("invalid argument");
+    }
+    input_data = static_cast<const INPUT_TYPE *>(inputs);
+    output_data = outputs;
+    input_num = count;
+    RunExecutors();
+  });
+}
+
+int ngen_set_batching(ngen_network *net, size_t max_batch,
+                      unsigned timeout_us) {
+  return TryRun([&] {
+    if (net != &network) throw std::runtime_error("invalid argument");
+    std::lock_guard<std::mutex> lock(network.batcher.mutex);
+    network.batcher.max_size = max_batch;
+    network.batcher.timeout = std::chrono::microseconds(timeout_us);
+  });
+}
+
+void ngen_free(ngen_network *net) {
+  std::lock_guard<std::mutex> lock(library_mutex);
+  if (net != &network || !loaded) return;
+  ReleaseAll();
+  loaded = false;
+  network.batcher.max_size = 0;
+}
+
+int ngen_cache_init(size_t bytes) {
+  if (!bytes) return 0;
+  last_error = "result cache is not supported by OpenCL networks";
+  return -1;
+}
+
+void ngen_cache_stats(uint64_t *hits, uint64_t *misses) {
+  if (hits) *hits = 0;
+  if (misses) *misses = 0;
+}
+
+const char *ngen_last_error(void) { return last_error.c_str(); }
+#else
 int main(int argc, const char *argv[]) {
   // check & parse arguments
-  if (argc < 5) {
-    std::cerr << "Usage: " << argv[0] << " PLAT_ID DEV_ID MODEL <INPUT ...>"
-              << std::endl;
+  auto arg = ParseOptions(argc, argv);
+  if (!arg || argc - arg < 4) {
+    std::cerr << "Usage: " << argv[0] << " [-o RESULT [-k K] [-t]]"
+              << " PLAT_ID DEV_DESC MODEL <INPUT ...>" << std::endl;
     return 1;
   }
-  auto plat_id = std::strtoul(argv[1], nullptr, 10);
-  auto dev_id = std::strtoul(argv[2], nullptr, 10);
-  std::string_view mod_file = argv[3];
+  auto plat_id = std::strtoul(argv[arg], nullptr, 10);
+  std::string_view dev_desc = argv[arg + 1];
+  std::string_view mod_file = argv[arg + 2];
 
   // initialize OpenCL related stuffs
-  InitDevice(plat_id, dev_id);
+  InitDevice(plat_id, dev_desc);
   InitContext();
   LoadProgram();
   InitKernels();
+  InitBatches();
 
   // read model data
   std::ifstream ifs;
   OpenFile(ifs, mod_file);
-  auto model = ReadModel(ifs);
+  ReadModel(ifs);
 
-  // read inputs
-  for (int i = 4; i < argc; ++i) {
-    // read input from file
-    OpenFile(ifs, argv[i]);
-    auto input = ReadInput(ifs);
-    // infer
-    auto output = Infer(model, std::move(input));
-    DumpOutput(output);
-    std::cout << GetMaxIndex(output) << std::endl;
-  }
+  // initialize outputs, text outputs are flushed only at exit
+  input_files = argv + arg + 3;
+  input_num = argc - arg - 3;
+  if (!options.result_file.empty()) OpenResultFile(input_num);
+  std::ios::sync_with_stdio(false);
+  std::cerr.unsetf(std::ios::unitbuf);
+
+  // run all executors
+  RunExecutors();
+  CloseResultFile();
+  std::cerr.flush();
   return 0;
 }
+#endif  // NGEN_LIBRARY
@@ -0,0 +1,34 @@
+// weight & bias of all layers are arguments of the fused kernel
+#define PARAM_EXPANDER(type, id, input, output)            \
+  , global const float *CONCAT(weight_, id),               \
+      global const float *CONCAT(bias_, id)
+
+// run layers in turn, outputs are visible to the next layer after barrier
+#define LAYER_EXPANDER(type, id, input, output)                    \
+  type(id)(input, output, CONCAT(weight_, id), CONCAT(bias_, id)); \
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+// run the whole network, each work-group runs all layers for
+// `FUSED_IMAGES` inputs, activations between layers stay in local memory
+kernel void Network(global float *in,
+                    global float *out FUSED_LAYERS(PARAM_EXPANDER)) {
+  // ping-pong buffers of activations
+  local float act0[FUSED_LOCAL0];
+  local float act1[FUSED_LOCAL1];
+  size_t first = get_group_id(0) * FUSED_IMAGES;
+  // inputs may be raw data
+  global const float *input =
+      (global const float *)((global const FUSED_INPUT_TYPE *)in +
+                             first * FUSED_INPUT_SIZE);
+  global float *output = out + first * FUSED_OUTPUT_SIZE;
+  FUSED_LAYERS(LAYER_EXPANDER)
+}
+
+#undef PARAM_EXPANDER
+#undef LAYER_EXPANDER
+#undef FUSED_LAYERS
+#undef FUSED_LOCAL0
+#undef FUSED_LOCAL1
+#undef FUSED_INPUT_TYPE
+#undef FUSED_INPUT_SIZE
+#undef FUSED_OUTPUT_SIZE
@@ -1,10 +1,64 @@
 #define SCALE_FACTOR (1.0 / (KERNEL_WIDTH * KERNEL_HEIGHT))
 
+#ifdef RAW_INPUT
+#define POOL_INPUT(x, y) READ_RAW_INPUT(raw, x, y, i)
+#else
+#define POOL_INPUT(x, y) in[(y)*INPUT_WIDTH + (x) + block]
+#endif  // RAW_INPUT
+
+#ifdef FUSED
+#define OUTPUT_ELEMS (OUTPUT_WIDTH * OUTPUT_HEIGHT * OUTPUT_DEPTH)
+
+DECL_LAYER(POOLING, LAYER_ID) {
+  // work-items of the group loop over outputs of all its inputs
+  for (size_t j = get_local_id(0); j < FUSED_IMAGES * OUTPUT_ELEMS;
+       j += get_local_size(0)) {
+    size_t batch = j / OUTPUT_ELEMS, index = j % OUTPUT_ELEMS;
+    size_t i = index / (OUTPUT_WIDTH * OUTPUT_HEIGHT);
+    size_t y = index / OUTPUT_WIDTH % OUTPUT_HEIGHT;
+    size_t x = index % OUTPUT_WIDTH;
+#ifdef RAW_INPUT
+    global const RAW_INPUT_TYPE *raw = RAW_INPUT_PTR(batch);
+#else
+    size_t block = INPUT_WIDTH * INPUT_HEIGHT * (batch * INPUT_DEPTH + i);
+#endif  // RAW_INPUT
+    size_t rows = y * KERNEL_WIDTH;
+    size_t cols = x * KERNEL_HEIGHT;
+#if defined(FUNCTION_AVERAGE)
+    float cur = 0.0;
+    for (size_t m = 0; m < KERNEL_WIDTH; m++) {
+      for (size_t n = 0; n < KERNEL_HEIGHT; n++) {
+        cur += weight[i] * POOL_INPUT(cols + n, rows + m);
+      }
+    }
+    cur *= SCALE_FACTOR;
+#elif defined(FUNCTION_MAX)
+    float cur = -1e9;
+    for (size_t m = 0; m < KERNEL_WIDTH; m++) {
+      for (size_t n = 0; n < KERNEL_HEIGHT; n++) {
+        float v = weight[i] * POOL_INPUT(cols + n, rows + m);
+        if (v > cur) cur = v;
+      }
+    }
+#endif
+    out[j] = ACT_FUNC(ACTIVATION)(cur + bias[i]);
+  }
+}
+
+#undef OUTPUT_ELEMS
+#else
 DECL_LAYER(POOLING, LAYER_ID) {
-  size_t i = get_global_id(0);
+  size_t batch = get_global_id(0) / OUTPUT_DEPTH;
+  size_t i = get_global_id(0) % OUTPUT_DEPTH;
   size_t y = get_global_id(1);
   size_t x = get_global_id(2);
+#ifdef RAW_INPUT
+  global const RAW_INPUT_TYPE *raw = RAW_INPUT_PTR(batch);
+#else
+  in += batch * INPUT_WIDTH * INPUT_HEIGHT * INPUT_DEPTH;
   size_t block = INPUT_WIDTH * INPUT_HEIGHT * i;
+#endif  // RAW_INPUT
+  out += batch * OUTPUT_WIDTH * OUTPUT_HEIGHT * OUTPUT_DEPTH;
   size_t rows = y * KERNEL_WIDTH;
   size_t cols = x * KERNEL_HEIGHT;
   size_t index =
@@ -13,8 +67,7 @@ DECL_LAYER(POOLING, LAYER_ID) {
   out[index] = 0.0;
   for (size_t m = 0; m < KERNEL_WIDTH; m++) {
     for (size_t n = 0; n < KERNEL_HEIGHT; n++) {
-      out[index] +=
-          weight[i] * in[(rows + m) * INPUT_WIDTH + cols + n + block];
+      out[index] += weight[i] * POOL_INPUT(cols + n, rows + m);
     }
   }
   out[index] *= SCALE_FACTOR;
@@ -22,7 +75,7 @@ DECL_LAYER(POOLING, LAYER_ID) {
   out[index] = -1e9;
   for (size_t m = 0; m < KERNEL_WIDTH; m++) {
     for (size_t n = 0; n < KERNEL_HEIGHT; n++) {
-      float cur = weight[i] * in[(rows + m) * INPUT_WIDTH + cols + n + block];
+      float cur = weight[i] * POOL_INPUT(cols + n, rows + m);
       if (cur > out[index]) out[index] = cur;
     }
   }
@@ -30,7 +83,9 @@ DECL_LAYER(POOLING, LAYER_ID) {
   out[index] += bias[i];
   out[index] = ACT_FUNC(ACTIVATION)(out[index]);
 }
+#endif  // FUSED
 
+#undef POOL_INPUT
 #undef LAYER_ID
 #undef FUNCTION_AVERAGE
 #undef FUNCTION_MAX
@@ -46,3 +101,14 @@ DECL_LAYER(POOLING, LAYER_ID) {
 #undef OUTPUT_HEIGHT
 #undef OUTPUT_DEPTH
 #undef ACTIVATION
+#undef RAW_INPUT
+#undef RAW_INPUT_TYPE
+#undef RAW_WIDTH
+#undef RAW_HEIGHT
+#undef RAW_DEPTH
+#undef INPUT_PAD_X
+#undef INPUT_PAD_Y
+#undef INPUT_SCALE
+#undef INPUT_OFFSET
+#undef INPUT_SPACE
+#undef OUTPUT_SPACE
@@ -0,0 +1,241 @@
+from typing import Dict, List, Tuple, Any
+from neural_gen.layer import Layer, Convolution, Pooling, FullConnection
+from neural_gen.network import Network
+from neural_gen.generator import Generator, CppGenerator, OpenCLGenerator
+from os import path, cpu_count
+import json
+import platform
+import shlex
+import subprocess
+import tempfile
+
+
+'''
+Configuration of a layer: number of OpenMP threads (`threads`), whether
+to parallelize only the outer loop (`outer`), and the unroll factor of
+the loop over inputs (`unroll`) of C++ layers, or tile sizes and
+work-group shape of tiled OpenCL kernels (see `OpenCLGenerator`).
+'''
+LayerConfig = Dict[str, Any]
+
+
+def cpu_identity() -> str:
+  '''
+  Get identity of the local CPU, including its model name and the number
+  of logical CPUs.
+  '''
+  name = platform.processor() or platform.machine()
+  try:
+    with open('/proc/cpuinfo', 'r') as f:
+      for line in f:
+        if line.startswith('model name'):
+          name = line.split(':', 1)[1].strip()
+          break
+  except OSError:
+    pass
+  return f'{name} x{cpu_count()}'
+
+
+class TuningDB:
+  '''
+  Tuning database, stores the best configurations of layers keyed by CPU
+  or OpenCL device identities and layer keys in a JSON file.
+  '''
+
+  def __init__(self, file: str) -> None:
+    self.__file = file
+    self.__data = {}
+    if path.exists(file):
+      with open(file, 'r') as f:
+        self.__data = json.load(f)
+
+  def identities(self) -> List[str]:
+    '''
+    Get identities of all CPUs and devices in the database.
+    '''
+    return list(self.__data)
+
+  def configs(self, identity: str) -> Dict[str, LayerConfig]:
+    '''
+    Get configurations of all layers tuned on the specific CPU or device.
+    '''
+    return self.__data.get(identity, {})
+
+  def update(self, identity: str, configs: Dict[str, LayerConfig]) -> None:
+    '''
+    Update configurations of layers tuned on the specific CPU or device.
+    '''
+    self.__data.setdefault(identity, {}).update(configs)
+
+  def save(self) -> None:
+    '''
+    Save the database to file.
+    '''
+    with open(self.__file, 'w') as f:
+      json.dump(self.__data, f, indent=2, sort_keys=True)
+      f.write('\n')
+
+
+class Tuner:
+  '''
+  Empirical tuner of C++ layers, benchmarks candidate configurations of
+  all layers on the local machine and picks the fastest ones.
+  '''
+
+  '''
+  Candidates of unroll factors of the loop over inputs.
+  '''
+  __UNROLLS = (1, 2, 4)
+
+  def __init__(self, cxx: str, repeats: int = 50) -> None:
+    # command for compiling benchmarks
+    self.__cxx = cxx
+    # number of runs of each variant
+    self.__repeats = repeats
+
+  @staticmethod
+  def __candidates(layer: Layer) -> List[LayerConfig]:
+    '''
+    Get candidate configurations of the specific layer.
+    '''
+    cpus = cpu_count() or 1
+    threads = sorted({1 << i for i in range(cpus.bit_length())} | {cpus})
+    threads = [0] + [t for t in threads if t > 1]
+    unrolls = (1,) if isinstance(layer, Pooling) else Tuner.__UNROLLS
+    outers = (False,) if isinstance(layer, FullConnection) else (False, True)
+    configs = []
+    for t in threads:
+      for outer in (outers if t > 1 else (False,)):
+        for unroll in unrolls:
+          configs.append({'threads': t, 'outer': outer, 'unroll': unroll})
+    return configs
+
+  def __run_bench(self, network: Network,
+                  variants: List[Tuple[int, LayerConfig]]) -> List[float]:
+    '''
+    Generate, compile and run the benchmark of the specific variants,
+    returns the median time (in nanoseconds) of each variant.
+    '''
+    gen = CppGenerator()
+    gen.generate_bench(network, variants, self.__repeats)
+    with tempfile.TemporaryDirectory() as temp_dir:
+      src = path.join(temp_dir, 'bench.cpp')
+      exe = path.join(temp_dir, 'bench')
+      with open(src, 'w') as f:
+        gen.dump(f)
+      subprocess.run(shlex.split(self.__cxx) + [src, '-o', exe], check=True)
+      out = subprocess.run([exe], check=True, capture_output=True,
+                           text=True).stdout
+    times = {}
+    for line in out.splitlines():
+      variant_id, time = line.split()
+      times[variant_id] = float(time)
+    return [times[f'{i}_{k}'] for k, (i, _) in enumerate(variants)]
+
+  def tune(self, network: Network) -> Dict[str, LayerConfig]:
+    '''
+    Tune all layers of the specific network, returns the best
+    configurations (with their time in nanoseconds as `time`) keyed by
+    layer keys.
+    '''
+    variants = []
+    keys = set()
+    for i, layer in enumerate(network.layers[1:], 1):
+      key = Generator._layer_key(layer, network.layers[i - 1])
+      # layers with the same key are tuned only once
+      if key in keys:
+        continue
+      keys.add(key)
+      variants += [(i, c) for c in Tuner.__candidates(layer)]
+    times = self.__run_bench(network, variants)
+    best: Dict[str, LayerConfig] = {}
+    for (i, config), time in zip(variants, times):
+      key = Generator._layer_key(network.layers[i], network.layers[i - 1])
+      if key not in best or time < best[key]['time']:
+        best[key] = dict(config, time=time)
+    return best
+
+
+class OpenCLTuner:
+  '''
+  Empirical tuner of tiled OpenCL kernels, benchmarks candidate tile sizes
+  and work-group shapes of all layers on an OpenCL device through the
+  OpenCL host, and picks the fastest ones.
+  '''
+
+  def __init__(self, cxx: str, libs: str, platform_id: int = 0,
+               device: str = '0', repeats: int = 50) -> None:
+    # command for compiling benchmarks, and libraries to be linked
+    self.__cxx = cxx
+    self.__libs = libs
+    # platform ID and device descriptor of the device
+    self.__platform_id = platform_id
+    self.__device = device
+    # number of runs of each variant
+    self.__repeats = repeats
+
+  def __run_bench(self, network: Network, batch: int,
+                  variants: List[Tuple[int, LayerConfig]]
+                  ) -> Tuple[str, List[float]]:
+    '''
+    Generate, compile and run the benchmark of the specific variants,
+    returns identity of the device, and the median time (in nanoseconds)
+    of each variant on a batch.
+    '''
+    gen = OpenCLGenerator(True, batch)
+    gen.generate_bench(network, variants, self.__repeats)
+    with tempfile.TemporaryDirectory() as temp_dir:
+      src = path.join(temp_dir, 'bench.cpp')
+      exe = path.join(temp_dir, 'bench')
+      with open(src, 'w') as f:
+        gen.dump(f)
+      subprocess.run(shlex.split(self.__cxx) + [src, '-o', exe] +
+                     shlex.split(self.__libs), check=True)
+      out = subprocess.run([exe, str(self.__platform_id), self.__device],
+                           check=True, capture_output=True,
+                           text=True).stdout
+    lines = out.splitlines()
+    # the first line is identity of the device
+    identity = 'OpenCL ' + lines[0].split(' ', 1)[1]
+    times = {}
+    for line in lines[1:]:
+      variant_id, time = line.split()
+      times[variant_id] = float(time)
+    return identity, [times[f'{i}_{k}'] for k, (i, _) in enumerate(variants)]
+
+  def identity(self, network: Network) -> str:
+    '''
+    Get identity of the device, including its name, vendor, driver
+    version and the number of compute units.
+    '''
+    return self.__run_bench(network, 1, [])[0]
+
+  def tune(self, network: Network,
+           batch: int) -> Tuple[str, Dict[str, LayerConfig]]:
+    '''
+    Tune tiled kernels of all layers of the specific network with the
+    specific batch size, returns identity of the device, and the best
+    configurations (with their time in nanoseconds as `time`) keyed by
+    device layer keys.
+    '''
+    variants = []
+    keys = set()
+    for i, layer in enumerate(network.layers[1:], 1):
+      last_layer = network.layers[i - 1]
+      key = OpenCLGenerator._device_layer_key(layer, last_layer, batch)
+      # layers with the same key are tuned only once
+      if key in keys:
+        continue
+      keys.add(key)
+      candidates = OpenCLGenerator._tiling_candidates(layer, last_layer, batch)
+      variants += [(i, c) for c in candidates]
+    identity, times = self.__run_bench(network, batch, variants)
+    best: Dict[str, LayerConfig] = {}
+    for (i, config), time in zip(variants, times):
+      key = OpenCLGenerator._device_layer_key(
+          network.layers[i], network.layers[i - 1], batch)
+      # variants failed to run on the device are never picked
+      if time != float('inf') and \
+              (key not in best or time < best[key]['time']):
+        best[key] = dict(config, time=time)
+    return identity, best
@@ -27,7 +27,7 @@ def check(args: List[str], test_dir: str) -> Tuple[int, int]:
 
 
 if __name__ == '__main__':
-  if len(argv) < 4:
+  if len(argv) < 3:
     print(f'Usage: {argv[0]} <ARGS ...> TEST_DIR')
     exit(1)
   try:
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 const int kWidth = 32, kHeight = 32;
 const int kXPadding = 2, kYPadding = 2;
@@ -7,7 +8,8 @@ const float kScaleMin = -1, kScaleMax = 1;
 
 unsigned char *labels;
 float *images;
-int count;
+unsigned char *raw_images;
+int count, raw_size;
 
 int LogError(const char *msg) {
   fprintf(stderr, "%s\n", msg);
@@ -39,8 +41,9 @@ int Read(const char *in_name) {
   llen = ReverseInt(llen);
   fread(&temp, sizeof(int), 1, ifp);
   fread(&ilen, sizeof(int), 1, ifp);
-  fread(&iw, sizeof(int), 1, ifp);
+  // dimensions of images are stored as rows & columns
   fread(&ih, sizeof(int), 1, ifp);
+  fread(&iw, sizeof(int), 1, ifp);
   if (ReverseInt(temp) != 0x00000803) return LogError("invalid image file");
   ilen = ReverseInt(ilen);
   if (llen != ilen) return LogError("length mismatch");
@@ -56,13 +59,16 @@ int Read(const char *in_name) {
   }
   // read images
   images = (float *)malloc(ilen * kWidth * kHeight * sizeof(float));
+  raw_size = iw * ih;
+  raw_images = (unsigned char *)malloc(ilen * raw_size);
   for (int i = 0; i < ilen * kWidth * kHeight; ++i) images[i] = -1;
   for (int i = 0; i < ilen; ++i) {
     int addr = kWidth * kHeight * i;
-    for (int r = 0; r < iw; ++r) {
-      for (int c = 0; c < ih; ++c) {
+    for (int r = 0; r < ih; ++r) {
+      for (int c = 0; c < iw; ++c) {
         unsigned char temp = 0;
         fread(&temp, sizeof(temp), 1, ifp);
+        raw_images[raw_size * i + iw * r + c] = temp;
         images[addr + kWidth * (r + kYPadding) + c + kXPadding] =
             (temp / 255.0) * (kScaleMax - kScaleMin) + kScaleMin;
       }
@@ -71,31 +77,38 @@ int Read(const char *in_name) {
   return 0;
 }
 
-int DumpImage(const char *out_prefix, int label, int index) {
+int DumpImage(const char *out_prefix, int label, int index, int raw) {
   // open file
   char file_name[256];
   sprintf(file_name, "%s-%i-%i.bin", out_prefix, index, label);
   FILE *fp = fopen(file_name, "wb");
   if (!fp) return LogError("failed to create file");
-  // write data
-  float *arr = images + index * kWidth * kHeight;
-  fwrite(arr, kWidth * kHeight * sizeof(float), 1, fp);
+  // write data, raw images are dumped without padding & scaling
+  if (raw) {
+    fwrite(raw_images + index * raw_size, raw_size, 1, fp);
+  }
+  else {
+    float *arr = images + index * kWidth * kHeight;
+    fwrite(arr, kWidth * kHeight * sizeof(float), 1, fp);
+  }
+  fclose(fp);
   return 0;
 }
 
-int DumpMnist(const char *out_prefix) {
+int DumpMnist(const char *out_prefix, int raw) {
   for (int i = 0; i < count; ++i) {
-    int ret = DumpImage(out_prefix, labels[i], i);
+    int ret = DumpImage(out_prefix, labels[i], i, raw);
     if (ret) return ret;
   }
   return 0;
 }
 
 int main(int argc, const char *argv[]) {
-  if (argc < 3) {
-    fprintf(stderr, "Usage: %s IN_NAME OUT_PREFIX\n", argv[0]);
+  int raw = argc > 1 && !strcmp(argv[1], "-r");
+  if (argc < 3 + raw) {
+    fprintf(stderr, "Usage: %s [-r] IN_NAME OUT_PREFIX\n", argv[0]);
     return 1;
   }
-  if (Read(argv[1]) || DumpMnist(argv[2])) return 1;
+  if (Read(argv[1 + raw]) || DumpMnist(argv[2 + raw], raw)) return 1;
   return 0;
 }
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ngen.h"
+
+ngen_network *net;
+char *inputs;
+float *outputs;
+size_t input_size, output_size;
+
+int LogError(const char *msg) {
+  fprintf(stderr, "%s\n", msg);
+  return -1;
+}
+
+int ReadInput(const char *file, char *input) {
+  FILE *fp = fopen(file, "rb");
+  if (!fp) return LogError("failed to open input file");
+  // inputs are truncated or padded with zeros
+  size_t len = fread(input, 1, input_size, fp);
+  memset(input + len, 0, input_size - len);
+  fclose(fp);
+  return 0;
+}
+
+int Infer(const char *files[], int count) {
+  // read all inputs into a contiguous buffer
+  input_size = ngen_input_size(net);
+  output_size = ngen_output_size(net);
+  inputs = (char *)malloc(count * input_size);
+  outputs = (float *)malloc(count * output_size * sizeof(float));
+  if (!inputs || !outputs) return LogError("failed to allocate memory");
+  for (int i = 0; i < count; ++i) {
+    int ret = ReadInput(files[i], inputs + i * input_size);
+    if (ret) return ret;
+  }
+  // infer on the whole batch
+  if (ngen_infer_batch(net, inputs, count, outputs)) {
+    return LogError(ngen_last_error());
+  }
+  return 0;
+}
+
+void DumpOutputs(int count) {
+  for (int i = 0; i < count; ++i) {
+    const float *output = outputs + i * output_size;
+    size_t max_i = 0;
+    for (size_t j = 0; j < output_size; ++j) {
+      fprintf(stderr, j ? " %g" : "%g", output[j]);
+      if (output[j] > output[max_i]) max_i = j;
+    }
+    fprintf(stderr, "\n");
+    printf("%zu\n", max_i);
+  }
+}
+
+int main(int argc, const char *argv[]) {
+  if (argc < 4) {
+    fprintf(stderr, "Usage: %s PLAT_ID DEV_DESC MODEL <INPUT ...>\n",
+            argv[0]);
+    return 1;
+  }
+  if (ngen_abi_version() != NGEN_ABI_VERSION) {
+    return LogError("ABI version mismatch"), 1;
+  }
+  // load network
+  net = ngen_load(argv[3], strtoul(argv[1], NULL, 10), argv[2]);
+  if (!net) return LogError(ngen_last_error()), 1;
+  // infer & dump
+  int ret = Infer(argv + 4, argc - 4);
+  if (!ret) DumpOutputs(argc - 4);
+  ngen_free(net);
+  free(inputs);
+  free(outputs);
+  return ret ? 1 : 0;
+}